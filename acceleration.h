@@ -0,0 +1,55 @@
+//////////////////////////////
+// acceleration.h
+//
+// velocity-sensitive volume steps for the remote's knob and the '+'/'-' keys
+// Copyright Aaron Schraner, 2018
+// 
+// the input rate (encoder steps per second, from the arrival times of knob packets
+// and keys) picks a multiplier along a curve set by the accel
+// parameters:
+//   multiplier = 1 + accel * (rate - accthr) / 64, at most accmax
+// below accthr every step is exactly <base> volume steps, so slow turns stay precise.
+// input after a pause of more than 250ms starts over at rate 0.
+//
+
+#ifndef ACCELERATION_H
+#define ACCELERATION_H
+#include <stdint.h>
+#include "settings.h"
+
+class Acceleration {
+    private:
+        static const uint16_t pause = 250; // ms
+        uint16_t last;  // time of the previous input (ms, wraps)
+        uint16_t rate;  // smoothed steps per second
+        bool started;
+
+    public:
+        Acceleration(): last(0), rate(0), started(false) {}
+
+        // volume steps for <delta> input steps at <now> (ms), <base> steps each
+        int16_t steps(int8_t delta, uint16_t now, uint8_t base, const Settings& settings) {
+            const uint16_t interval = now - last;
+            const uint8_t magnitude = delta < 0 ? -delta : delta;
+            if(!started || interval > pause)
+                rate = 0;
+            else {
+                // steps per second over this interval, averaged with the previous rate
+                const uint16_t current = interval ? (uint32_t)magnitude * 1000 / interval : 1000;
+                rate = (rate + current) / 2;
+            }
+            last = now;
+            started = true;
+
+            // multiplier in 1/16ths
+            uint16_t multiplier = 16;
+            if(rate > settings.accel_threshold) {
+                const uint32_t extra = (uint32_t)settings.accel * (rate - settings.accel_threshold) / 4;
+                multiplier = 16 + extra > 16u * settings.accel_max ? 16u * settings.accel_max : 16 + extra;
+            }
+            const int16_t result = (uint32_t)magnitude * base * multiplier / 16;
+            return delta < 0 ? -result : result;
+        }
+};
+
+#endif
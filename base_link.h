@@ -0,0 +1,125 @@
+//////////////////////////////
+// base_link.h
+//
+// the base station's side of the remote protocol (remote_protocol.h)
+// Copyright Aaron Schraner, 2018
+//
+// poll() takes every received packet out of the radio: broadcast frames (pipe 2)
+// go to the node, knob packets move the volume, anything else is fed to the command
+// path byte by byte. after each packet on pipe 1 the status for the next ACK payload
+// is loaded, by the broadcast's callback instead while one is being sent. channel
+// moves are announced in that status and taken once the remote got the ACK, i.e.
+// when its next packet arrives.
+//
+// <Node> is the rest of the base, main.cpp and host/nrf_bench.cpp each have one:
+//   void move(int16_t steps)                   volume steps
+//   int16_t position() const                   volume steps applied since boot
+//   bool movable() const                       speaker-side encoder usable
+//   bool key(uint8_t value)                    a command byte, true if it was a key
+//   void broadcast(const uint8_t* packet, uint8_t length)   frame on pipe 2
+//   uint8_t rescan()                           a quieter channel to announce (0: none)
+//   void switch_channel(uint8_t channel)       the remote is on its way to <channel>
+//   void knob(const KnobPacket& knob, int16_t steps)        a knob packet was applied
+//
+
+#ifndef BASE_LINK_H
+#define BASE_LINK_H
+#include <stdint.h>
+#include "nrf.h"
+#include "remote_protocol.h"
+#include "acceleration.h"
+#include "settings.h"
+
+template <typename Node>
+class BaseLink {
+    private:
+        NRF& nrf;
+        Node& node;
+        const Settings& settings;
+        Acceleration accel;     // velocity-sensitive knob steps
+        uint8_t seq;            // seq of the last applied knob packet
+        bool first;             // it was a restarted remote's first packet (KNOB_FIRST)
+        uint16_t first_time;    // and had this timestamp
+        uint8_t next_channel;   // channel announced to the remote (0: none)
+        bool announced;         // the ACK payload waiting for the remote announces it
+
+    public:
+        BaseLink(NRF& nrf, Node& node, const Settings& settings): nrf(nrf), node(node),
+            settings(settings), seq(0), first(false), first_time(0), next_channel(0), announced(false) {}
+
+        // load the status returned in the ACK to the remote's next packet
+        void load_status() {
+            BaseStatus status;
+            status.type = REMOTE_STATUS;
+            status.version = REMOTE_PROTOCOL_VERSION;
+            status.seq = seq;
+            status.position = node.position();
+            status.flags = node.movable() ? STATUS_MOVABLE : 0;
+            status.channel = next_channel ? next_channel : settings.channel;
+            if(next_channel)
+                status.flags |= STATUS_CHANNEL_CHANGE;
+            announced = next_channel;
+            nrf.write_ack_payload(1, (const uint8_t*)&status, sizeof(status));
+        }
+
+        // apply the steps in a knob packet (3 volume steps per encoder step, like '+'
+        // and '-', more when the knob turns fast). <now> (ms) is its arrival: the
+        // remote's timestamps stop while it sleeps between detents.
+        void handle_knob(const KnobPacket& knob, uint16_t now) {
+            if(knob.version != REMOTE_PROTOCOL_VERSION)
+                return; // unknown format
+            // a restarted remote counts from 1 again, its first packets are new unless
+            // they repeat the first packet applied (same timestamp)
+            const bool restarted = (knob.flags & KNOB_FIRST) &&
+                !(first && knob.timestamp == first_time);
+            if(knob.seq == seq && !restarted)
+                return; // a retransmission of a packet that was applied already
+            seq = knob.seq;
+            first = knob.flags & KNOB_FIRST;
+            first_time = knob.timestamp;
+            if((knob.flags & KNOB_RESCAN) && !next_channel)
+                next_channel = node.rescan();
+            const int16_t steps = accel.steps(knob.delta, now, 3, settings);
+            node.move(steps);
+            node.knob(knob, steps);
+        }
+
+        // handle all received packets, returns true if a single-byte command was among them
+        bool poll(uint16_t now) {
+            bool key_pressed = false;
+            while(nrf.available()) {
+                uint8_t packet[32];
+                uint8_t pipe;
+                const uint8_t length = nrf.read(packet, &pipe);
+                if(pipe == 2) {
+                    node.broadcast(packet, length);
+                    continue;
+                }
+                // this packet's ACK carried the channel announcement
+                if(announced) {
+                    const uint8_t channel = next_channel;
+                    next_channel = 0;
+                    announced = false;
+                    node.switch_channel(channel);
+                }
+                if(length == sizeof(KnobPacket) && packet[0] == REMOTE_KNOB)
+                    handle_knob(*(const KnobPacket*)packet, now);
+                else {
+                    for(uint8_t i = 0; i < length && i < 32; i++)
+                        key_pressed |= node.key(packet[i]);
+                }
+                // the packet used up the previous status (on pipe 1). while a broadcast
+                // is on the air the radio is in TX mode, broadcast_sent() loads it then
+                if(!nrf.tx_busy())
+                    load_status();
+            }
+            return key_pressed;
+        }
+
+        // channel announced to the remote (0: none)
+        uint8_t announcing() const {
+            return next_channel;
+        }
+};
+
+#endif
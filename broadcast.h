@@ -0,0 +1,91 @@
+//////////////////////////////
+// broadcast.h
+//
+// compressed per-LED intensity frames, sent by a master analyzer to slave strips
+// Copyright Aaron Schraner, 2018
+// 
+// a frame is one 32-byte nRF payload (sent without ACK):
+//
+//   0xB0 | shift | seq | value 0 | 57 4-bit deltas (29 bytes, low nibble first)
+//
+// the deltas are signed (-8..7) and scaled by 2^shift. the encoder picks the
+// smallest shift that covers the largest step between neighbouring LEDs and
+// tracks the decoder's reconstruction (closed loop), so errors don't accumulate
+// along the strip. seq increments every frame, gaps are dropped frames.
+//
+
+#ifndef BROADCAST_H
+#define BROADCAST_H
+#include <stdint.h>
+
+const uint8_t BROADCAST_TYPE = 0xB0;       // upper nibble of the first byte
+const uint8_t BROADCAST_VALUES = 58;       // intensities per frame (one per LED)
+const uint8_t BROADCAST_FRAME_SIZE = 32;
+const uint8_t BROADCAST_MAX_SHIFT = 5;
+
+// role of a node (the "mode" parameter)
+enum NodeMode: uint8_t {
+    NODE_STANDALONE, // analyzes its own input
+    NODE_MASTER,     // analyzes its own input and broadcasts the intensities
+    NODE_SLAVE       // only renders broadcast intensities
+};
+
+// apply a 4-bit delta to a reconstructed value (identical in encoder and decoder)
+inline uint8_t broadcast_step(uint8_t value, int8_t delta, uint8_t shift) {
+    const int16_t next = value + delta * (1 << shift);
+    return next < 0 ? 0 : next > 255 ? 255 : next;
+}
+
+// encode BROADCAST_VALUES intensities into <frame> (BROADCAST_FRAME_SIZE bytes)
+inline void broadcast_encode(uint8_t* frame, uint8_t seq, const uint8_t* values) {
+    // smallest step size that can follow the steepest edge
+    uint8_t max_step = 0;
+    for(uint8_t i = 1; i < BROADCAST_VALUES; i++) {
+        const uint8_t step = values[i] > values[i-1] ? 
+            values[i] - values[i-1] : values[i-1] - values[i];
+        if(step > max_step)
+            max_step = step;
+    }
+    uint8_t shift = 0;
+    while(shift < BROADCAST_MAX_SHIFT && (7 << shift) < max_step)
+        shift++;
+
+    frame[0] = BROADCAST_TYPE | shift;
+    frame[1] = seq;
+    frame[2] = values[0];
+    uint8_t value = values[0];
+    const int16_t half = (1 << shift) >> 1;
+    for(uint8_t i = 1; i < BROADCAST_VALUES; i++) {
+        // rounded quantized difference to the reconstructed value
+        const int16_t difference = values[i] - value;
+        int8_t delta = difference >= 0 ? 
+            (difference + half) >> shift : -((half - difference) >> shift);
+        delta = delta > 7 ? 7 : delta < -8 ? -8 : delta;
+        value = broadcast_step(value, delta, shift);
+
+        uint8_t& byte = frame[3 + (i - 1) / 2];
+        if((i - 1) % 2 == 0)
+            byte = delta & 0x0F;
+        else
+            byte |= delta << 4;
+    }
+}
+
+// decode <frame> into BROADCAST_VALUES intensities, false if it isn't a broadcast frame
+inline bool broadcast_decode(const uint8_t* frame, uint8_t length, uint8_t* values, uint8_t* seq) {
+    if(length != BROADCAST_FRAME_SIZE || (frame[0] & 0xF0) != BROADCAST_TYPE ||
+            (frame[0] & 0x0F) > BROADCAST_MAX_SHIFT)
+        return false;
+    const uint8_t shift = frame[0] & 0x0F;
+    *seq = frame[1];
+    values[0] = frame[2];
+    for(uint8_t i = 1; i < BROADCAST_VALUES; i++) {
+        const uint8_t byte = frame[3 + (i - 1) / 2];
+        const uint8_t nibble = (i - 1) % 2 == 0 ? byte & 0x0F : byte >> 4;
+        const int8_t delta = nibble & 0x08 ? nibble - 16 : nibble;
+        values[i] = broadcast_step(values[i-1], delta, shift);
+    }
+    return true;
+}
+
+#endif
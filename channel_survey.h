@@ -0,0 +1,90 @@
+//////////////////////////////
+// channel_survey.h
+//
+// background RF channel survey using the nRF24's carrier detect
+// Copyright Aaron Schraner, 2018
+// 
+// step() samples one channel per call (about 0.4ms away from the home channel,
+// the remote's retransmissions cover for that), so a full sweep of
+// CHANNEL_MIN..CHANNEL_MAX takes one call per channel. the caller stops stepping once
+// a sweep is complete() and restart()s it when the results have been used. each channel keeps a decaying
+// count of carrier detections, quietest() weighs in the neighbouring channels
+// because wifi and bluetooth occupy more than the 1MHz of a channel.
+//
+
+#ifndef CHANNEL_SURVEY_H
+#define CHANNEL_SURVEY_H
+#include <util/delay.h>
+#include "nrf.h"
+#include "remote_protocol.h"
+
+class ChannelSurvey {
+    private:
+        static const uint8_t channels = CHANNEL_MAX - CHANNEL_MIN + 1;
+        static const uint8_t samples = 4;
+        uint8_t occupancy[channels]; // decaying carrier count, up to 192
+        uint8_t next;                // next channel to sample (index)
+        bool swept;                  // every channel sampled at least once
+
+    public:
+        ChannelSurvey(): occupancy(), next(0), swept(false) {}
+
+        // sample the next channel, then return to <home> (radio must be listening)
+        void step(NRF& nrf, uint8_t home) {
+            const uint8_t channel = CHANNEL_MIN + next;
+            uint8_t hits = 0;
+            if(channel != home) { // home is busy with our own traffic
+                nrf.stop_listening();
+                nrf.set_freq(channel);
+                nrf.resume_listening();
+                _delay_us(170);
+                for(uint8_t i = 0; i < samples; i++) {
+                    hits += nrf.carrier();
+                    _delay_us(40);
+                }
+                nrf.stop_listening();
+                nrf.set_freq(home);
+                nrf.resume_listening();
+            }
+            occupancy[next] = occupancy[next] - occupancy[next] / 4 + hits * 12;
+
+            if(++next == channels) {
+                next = 0;
+                swept = true;
+            }
+        }
+
+        // true once every channel has been sampled
+        bool complete() const {
+            return swept;
+        }
+
+        // start another sweep (the counts keep decaying from the last one)
+        void restart() {
+            next = 0;
+            swept = false;
+        }
+
+        // occupancy of <channel> (0-192)
+        uint8_t level(uint8_t channel) const {
+            return channel < CHANNEL_MIN || channel > CHANNEL_MAX ? 0 : occupancy[channel - CHANNEL_MIN];
+        }
+
+        // channel with the least activity on it and its neighbours
+        uint8_t quietest() const {
+            uint8_t best = CHANNEL_MIN;
+            uint16_t best_score = 0xFFFF;
+            for(uint8_t i = 0; i < channels; i++) {
+                uint16_t score = occupancy[i] * 2;
+                score += i > 0 ? occupancy[i-1] : occupancy[i];
+                score += i < channels - 1 ? occupancy[i+1] : occupancy[i];
+                if(score < best_score) {
+                    best_score = score;
+                    best = CHANNEL_MIN + i;
+                }
+            }
+            return best;
+        }
+};
+
+#endif
@@ -46,11 +46,13 @@ class CircularBuffer {
                 advance(starti);
                 return temp;
             }
-            // return default constructed object if buffer empty
-            T d;
-            return d;
+            // return a value-initialized (zeroed) object if buffer empty
+            return T();
         }
+        const T& peek() const { return data[starti]; }
         int length() const { return len; }
+        // length read from memory on every call, for polling a buffer an interrupt changes
+        int volatile_length() const { return *(const volatile int*)&len; }
         bool empty() const { return len == 0; }
         bool full() const { return len == size; }
         void flush() { starti = endi = len = 0; }
@@ -0,0 +1,126 @@
+//////////////////////////////
+// command.h
+//
+// incremental parser for the runtime command protocol
+// Copyright Aaron Schraner, 2018
+// 
+// the protocol is a superset of the single-byte commands ('+', '-', '?', ...):
+//   :name=value<end>  set a parameter (see settings.h), replies "name=value"
+//   :name<end>        get a parameter, replies "name=value"
+//   :<end>            list every parameter, one "name=value" line each
+// where <end> is '\n', '\r' or ';'. errors are replied as "!name".
+// any byte outside of a ':' command is handed back to the caller unchanged.
+//
+// bytes are fed one at a time as they arrive (from the USART rx buffer or out of
+// nRF payloads), so a command may be split across any number of reads or packets.
+// use one parser per input so that interleaved inputs can't corrupt each other.
+//
+
+#ifndef COMMAND_H
+#define COMMAND_H
+#include <avr/pgmspace.h>
+#include "settings.h"
+
+// called after a parameter has been changed
+typedef void (*ParameterCallback)(uint8_t id);
+
+template <typename Output>
+class CommandParser {
+    private:
+        static const int max_length = 16;
+        Output& out;
+        Settings& settings;
+        ParameterCallback on_change;
+        char line[max_length + 1];
+        int8_t length; // bytes in line, -1 if not inside a command
+
+        void reply(uint8_t id) {
+            out.printf_P(PSTR("%S=%u\n"), parameters[id].name, get_parameter(settings, id));
+        }
+
+        // look up a parameter by name, PARAM_COUNT if it doesn't exist
+        uint8_t find(const char* name) const {
+            for(uint8_t id=0; id<PARAM_COUNT; id++)
+                if(!strcmp_P(name, parameters[id].name))
+                    return id;
+            return PARAM_COUNT;
+        }
+
+        void execute() {
+            if(length > max_length) {
+                out.printf_P(PSTR("!overflow\n"));
+                return;
+            }
+            line[length] = 0;
+
+            if(length == 0) {
+                for(uint8_t id=0; id<PARAM_COUNT; id++)
+                    reply(id);
+                return;
+            }
+
+            // split "name=value"
+            char* value = 0;
+            for(char* c = line; *c; c++) {
+                if(*c == '=') {
+                    *c = 0;
+                    value = c + 1;
+                    break;
+                }
+            }
+
+            const uint8_t id = find(line);
+            if(id == PARAM_COUNT) {
+                out.printf_P(PSTR("!%s\n"), line);
+                return;
+            }
+            if(value) {
+                uint32_t number = 0;
+                if(!*value) {
+                    out.printf_P(PSTR("!%s\n"), line);
+                    return;
+                }
+                for(; *value; value++) {
+                    if(*value < '0' || *value > '9') {
+                        out.printf_P(PSTR("!%s\n"), line);
+                        return;
+                    }
+                    number = number * 10 + *value - '0';
+                    if(number > 0xFFFF)
+                        number = 0xFFFF; // saturate, set_parameter() clamps to the range
+                }
+                set_parameter(settings, id, number);
+                if(on_change)
+                    on_change(id);
+            }
+            reply(id);
+        }
+
+    public:
+        CommandParser(Output& out, Settings& settings, ParameterCallback on_change = 0):
+            out(out), settings(settings), on_change(on_change), length(-1) {}
+
+        // process one input byte
+        // returns the byte if it is a single-byte command for the caller to handle,
+        // or -1 if it was consumed by the parser
+        int feed(uint8_t c) {
+            if(length < 0) {
+                if(c != ':')
+                    return c;
+                length = 0;
+                return -1;
+            }
+            if(c == '\n' || c == '\r' || c == ';') {
+                execute();
+                length = -1;
+            } else if(length <= max_length) {
+                // one byte past max_length marks an overflow
+                if(length < max_length)
+                    line[length] = c;
+                length++;
+            }
+            return -1;
+        }
+};
+
+#endif
@@ -0,0 +1,33 @@
+//////////////////////////////
+// crc.h
+//
+// CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF)
+// plain C++ so the firmware and the host tools compute the same checksum
+// Copyright Aaron Schraner, 2018
+// 
+
+#ifndef CRC_H
+#define CRC_H
+#include <stdint.h>
+
+const uint16_t CRC16_INIT = 0xFFFF;
+
+// add one byte to a running CRC
+// (table-free, same result as avr-libc's _crc_xmodem_update)
+inline uint16_t crc16_update(uint16_t crc, uint8_t data) {
+    crc = (crc >> 8) | (crc << 8);
+    crc ^= data;
+    crc ^= (crc & 0xFF) >> 4;
+    crc ^= crc << 12;
+    crc ^= (crc & 0xFF) << 5;
+    return crc;
+}
+
+// CRC of a whole buffer
+inline uint16_t crc16(const uint8_t* data, int length, uint16_t crc = CRC16_INIT) {
+    for(int i=0; i<length; i++)
+        crc = crc16_update(crc, data[i]);
+    return crc;
+}
+
+#endif
@@ -0,0 +1,54 @@
+//////////////////////////////
+// eeprom.h
+//
+// non-blocking byte access to the internal EEPROM
+// on the host (no __AVR__) these are implemented by host/eeprom_sim.cpp
+// Copyright Aaron Schraner, 2018
+// 
+//
+#ifndef EEPROM_H
+#define EEPROM_H
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+const uint16_t EEPROM_SIZE = E2END + 1;
+
+// true if no write is in progress
+inline bool ee_ready() {
+    return !(EECR & _BV(EEPE));
+}
+
+// read one byte (waits for a pending write to finish)
+inline uint8_t ee_read(uint16_t address) {
+    while(!ee_ready());
+    EEAR = address;
+    EECR |= _BV(EERE);
+    return EEDR;
+}
+
+// start writing one byte, only call this when ee_ready()
+// the write itself takes about 3.4ms and runs in the background
+inline void ee_write(uint16_t address, uint8_t value) {
+    EEAR = address;
+    EEDR = value;
+    const uint8_t sreg = SREG;
+    cli(); // EEPE must be set within 4 cycles of EEMPE
+    EECR = _BV(EEMPE); // erase and write, EEPM = 0
+    EECR |= _BV(EEPE);
+    SREG = sreg;
+}
+
+#else
+
+const uint16_t EEPROM_SIZE = 4096;
+
+bool ee_ready();
+uint8_t ee_read(uint16_t address);
+void ee_write(uint16_t address, uint8_t value);
+
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+//////////////////////////////
+// effects.h
+//
+// visualizer effects: the per-LED intensities shown on the strip, made from the
+// spectrum and beat data of each analysis frame
+// Copyright Aaron Schraner, 2018
+//
+// an effect is three functions in the effects[] table (in flash, like the parameter
+// table): init() when it is selected, update() once per analysis frame and render()
+// to write the strip's intensities. all effects share one EffectState, only the
+// selected one uses it, so switching effects (the "effect" parameter) costs no RAM.
+//
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+const uint8_t effect_max_leds = 64;
+
+// shared input of the effects, filled once per analysis frame
+struct EffectInput {
+    const uint8_t* spectrum; // per-LED intensities (envelope.h), lowest frequency first
+    uint8_t leds;            // number of LEDs (at most effect_max_leds)
+    uint8_t level;           // loudness (effect_level())
+    uint8_t onset;           // onset strength (onset.h) if this frame is an onset, else 0
+    uint8_t phase;           // beat clock phase (tempo.h), 0 on the beat
+    bool locked;             // the beat clock has a tempo
+};
+
+// state of the selected effect
+struct EffectState {
+    uint8_t values[effect_max_leds]; // history, tail or whatever the effect keeps per LED
+    uint16_t position;               // 8.8 fixed point LED position
+    uint8_t peak, hold;
+    uint8_t last_phase;
+};
+
+struct Effect {
+    char name[8];
+    void (*init)(EffectState& state);
+    void (*update)(EffectState& state, const EffectInput& input);
+    void (*render)(const EffectState& state, const EffectInput& input, uint8_t* out);
+};
+
+// loudness of a frame: twice the mean intensity, up to 255
+inline uint8_t effect_level(const uint8_t* spectrum, uint8_t leds) {
+    uint16_t sum = 0;
+    for(uint8_t i = 0; i < leds; i++)
+        sum += spectrum[i];
+    const uint16_t level = sum * 2 / leds;
+    return level > 255 ? 255 : level;
+}
+
+inline void effect_clear(EffectState& state) {
+    for(uint8_t i = 0; i < effect_max_leds; i++)
+        state.values[i] = 0;
+    state.position = 0;
+    state.peak = state.hold = state.last_phase = 0;
+}
+
+inline void effect_no_update(EffectState&, const EffectInput&) {}
+
+// the values kept in the state, as they are
+inline void effect_render_values(const EffectState& state, const EffectInput& input, uint8_t* out) {
+    for(uint8_t i = 0; i < input.leds; i++)
+        out[i] = state.values[i];
+}
+
+// spectrum bars: the spectrum along the strip
+inline void bars_render(const EffectState&, const EffectInput& input, uint8_t* out) {
+    for(uint8_t i = 0; i < input.leds; i++)
+        out[i] = input.spectrum[i];
+}
+
+// VU meter: a bar as long as the loudness, with a peak that holds and falls
+inline void vu_update(EffectState& state, const EffectInput& input) {
+    const uint8_t length = (uint16_t)input.level * input.leds / 256;
+    if(length >= state.peak) {
+        state.peak = length;
+        state.hold = 20;
+    }
+    else if(state.hold)
+        state.hold--;
+    else if(state.peak)
+        state.peak--;
+}
+
+inline void vu_render(const EffectState& state, const EffectInput& input, uint8_t* out) {
+    const uint8_t length = (uint16_t)input.level * input.leds / 256;
+    for(uint8_t i = 0; i < input.leds; i++)
+        out[i] = i < length ? 48 + (uint16_t)i * 160 / input.leds : 0;
+    if(state.peak < input.leds)
+        out[state.peak] = 255;
+}
+
+// waterfall: the loudness enters at the start of the strip and scrolls along it
+inline void waterfall_update(EffectState& state, const EffectInput& input) {
+    for(uint8_t i = input.leds - 1; i > 0; i--)
+        state.values[i] = state.values[i - 1];
+    state.values[0] = input.level;
+}
+
+// center-out mirror: the spectrum from the middle to both ends, bass in the middle
+// (pairs of LEDs' bins folded into one, the loudest of them)
+inline void mirror_render(const EffectState&, const EffectInput& input, uint8_t* out) {
+    const uint8_t half = input.leds / 2;
+    for(uint8_t k = 0; k < half; k++) {
+        const uint8_t a = input.spectrum[2 * k], b = input.spectrum[2 * k + 1];
+        out[half - 1 - k] = out[input.leds - half + k] = a > b ? a : b;
+    }
+    if(input.leds & 1)
+        out[half] = input.spectrum[0];
+}
+
+// comet: a head that is launched on every onset (or beat, once the clock is locked)
+// and slows down along the strip, leaving a fading tail
+inline void comet_update(EffectState& state, const EffectInput& input) {
+    for(uint8_t i = 0; i < input.leds; i++)
+        state.values[i] = state.values[i] * 3 / 4;
+    const bool beat = input.locked ? input.phase < state.last_phase : input.onset;
+    state.last_phase = input.phase;
+    if(beat) {
+        state.position = 0;
+        state.peak = input.onset > 128 ? input.onset : 128 + input.level / 2; // brightness
+        state.hold = 255; // speed, 1/64 LED per frame
+    }
+    if(!state.peak)
+        return;
+    const uint8_t head = state.position >> 8;
+    if(head >= input.leds) {
+        state.peak = 0;
+        return;
+    }
+    state.position += state.hold * 4;
+    state.hold -= state.hold / 16;
+    // the head and the LEDs it passes this frame
+    const uint8_t next = state.position >> 8;
+    for(uint8_t i = head; i <= next && i < input.leds; i++)
+        state.values[i] = state.peak;
+}
+
+// effect ids (the "effect" parameter, index into effects[])
+enum EffectId: uint8_t {
+    EFFECT_BARS,
+    EFFECT_VU,
+    EFFECT_WATERFALL,
+    EFFECT_MIRROR,
+    EFFECT_COMET,
+    EFFECT_COUNT
+};
+
+const Effect effects[EFFECT_COUNT] PROGMEM = {
+    { "bars",   effect_clear, effect_no_update, bars_render          },
+    { "vu",     effect_clear, vu_update,        vu_render            },
+    { "scroll", effect_clear, waterfall_update, effect_render_values },
+    { "mirror", effect_clear, effect_no_update, mirror_render        },
+    { "comet",  effect_clear, comet_update,     effect_render_values },
+};
+
+// runs the selected effect out of effects[]
+class EffectEngine {
+    private:
+        EffectState state;
+        uint8_t current;
+
+    public:
+        EffectEngine(): current(EFFECT_BARS) {
+            effect_clear(state);
+        }
+
+        // switch to effect <id> (out of range: bars), starting from a fresh state
+        void select(uint8_t id) {
+            current = id < EFFECT_COUNT ? id : EFFECT_BARS;
+            reinterpret_cast<void (*)(EffectState&)>(pgm_read_ptr(&effects[current].init))(state);
+        }
+
+        uint8_t selected() const {
+            return current;
+        }
+
+        // one frame: update the effect with <input> and render its intensities into <out>
+        void run(const EffectInput& input, uint8_t* out) {
+            reinterpret_cast<void (*)(EffectState&, const EffectInput&)>(
+                    pgm_read_ptr(&effects[current].update))(state, input);
+            reinterpret_cast<void (*)(const EffectState&, const EffectInput&, uint8_t*)>(
+                    pgm_read_ptr(&effects[current].render))(state, input, out);
+        }
+};
+
+#endif
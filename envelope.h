@@ -0,0 +1,87 @@
+//////////////////////////////
+// envelope.h
+//
+// per-bin noise floor, attack/release envelope and peak hold for the FFT bins
+// Copyright Aaron Schraner, 2018
+//
+// one pass over the bins does, for every bin:
+//  - noise floor: follows drops of the bin right away (halfway per frame) and rises
+//    by floor_rise/16 per frame, so it settles on the bin's minimum. hum and the
+//    ADC's noise sit there permanently and get subtracted.
+//  - envelope: rises with alpha/256 and falls with release/256 of the difference
+//    per frame, so kicks come through at once and fade slowly.
+//  - peak hold (if peak_hold is not 0): the highest intensity stays for peak_hold
+//    frames, then decays by peak_decay per frame. the output is the larger of
+//    envelope and peak.
+// values are in 1/16ths internally, the output is the 8-bit intensity above
+// threshold / 2 like before, plus a boost for beat effects.
+//
+
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+#include <stdint.h>
+#include "settings.h"
+
+template <uint8_t N>
+class SpectrumEnvelope {
+    private:
+        static const uint16_t floor_limit = 96 * 16; // noise floor ceiling (loud hum)
+
+        uint16_t noise[N];  // noise floor (1/16ths)
+        uint16_t level[N];  // envelope above the floor (1/16ths)
+        uint8_t peak[N];    // held peak (intensity)
+        uint8_t hold[N];    // frames left to hold it
+
+    public:
+        SpectrumEnvelope(): noise(), level(), peak(), hold() {}
+
+        // process one frame: <bins> (N magnitudes) into <intensities> (N values),
+        // <boost> is added to every intensity
+        void process(const uint8_t* bins, uint8_t* intensities, const Settings& settings, uint8_t boost) {
+            const uint8_t attack = settings.alpha, release = settings.release,
+                          floor_rise = settings.floor_rise, threshold = settings.threshold,
+                          hold_frames = settings.peak_hold, peak_decay = settings.peak_decay;
+            for(uint8_t i = 0; i < N; i++) {
+                const uint16_t value = (uint16_t)bins[i] * 4 * 16; // scaled like the old WMA
+
+                // noise floor: fast down, slow up
+                uint16_t floor = noise[i];
+                if(value < floor)
+                    floor -= (floor - value + 1) / 2;
+                else if(floor < floor_limit)
+                    floor += floor_rise;
+                noise[i] = floor;
+
+                // envelope of what is above it
+                const uint16_t above = value > floor ? value - floor : 0;
+                uint16_t l = level[i];
+                if(above > l)
+                    l += (uint32_t)(above - l) * attack / 256 + 1;
+                else
+                    l -= (uint32_t)(l - above) * release / 256;
+                level[i] = l;
+
+                // threshold
+                const uint16_t whole = l / 16;
+                uint8_t intensity = whole > threshold ?
+                    (whole - threshold / 2 > 255 ? 255 : whole - threshold / 2) : 0;
+
+                // peak hold
+                if(hold_frames) {
+                    if(intensity >= peak[i]) {
+                        peak[i] = intensity;
+                        hold[i] = hold_frames;
+                    }
+                    else if(hold[i])
+                        hold[i]--;
+                    else
+                        peak[i] = peak[i] > peak_decay ? peak[i] - peak_decay : 0;
+                    if(peak[i] > intensity)
+                        intensity = peak[i];
+                }
+                intensities[i] = intensity + boost > 255 ? 255 : intensity + boost;
+            }
+        }
+};
+
+#endif
@@ -265,3 +265,52 @@ int fix_fftr(char f[], int m, int inverse)
     return scale;
 }
 
+/*
+  fix_fftr_mag() - magnitudes of the real FFT of N = 2**m samples.
+  The even samples must be in f[0]-f[N/2-1] and the odd samples in
+  f[N/2]-f[N-1]. A half-size complex FFT transforms them as real
+  and imaginary parts, then the spectra of the even and odd samples
+  are separated (using the conjugate symmetry of real signals) and
+  combined with the twiddle factors from Sinewave[]. Bins k and
+  N/2-k come from the same pair of complex bins, so the result can
+  replace them in place: f[0]-f[N/2-1] (as unsigned char) gets the
+  approximate magnitudes abs(real)/2 + abs(imag)/2 of bins 0 to
+  N/2-1, scaled like the complex fix_fft() of N real samples.
+  The return value is always 0.
+*/
+int fix_fftr_mag(char f[], int m)
+{
+    int n = 1<<(m-1), k, mirror, step = N_WAVE >> m;
+    int er, ei, or_, oi, tr, ti, wr, wi, xr, xi, yr, yi;
+    unsigned char *mag = (unsigned char*)f;
+    char *fr = f, *fi = &f[n];
+
+    if (m > LOG2_N_WAVE)
+      return -1;
+    fix_fft(fr, fi, m-1, 0);
+
+    for (k=0; k<=n/2; ++k) {
+      mirror = (n - k) & (n - 1);
+      /* twice the even and odd samples' spectra at k */
+      er = fr[k] + fr[mirror];
+      ei = fi[k] - fi[mirror];
+      or_ = fi[k] + fi[mirror];
+      oi = fr[mirror] - fr[k];
+      /* times exp(-2 pi j k / N) */
+      wr = pgm_read_byte_near(Sinewave + k*step + N_WAVE/4);
+      wi = pgm_read_byte_near(Sinewave + k*step);
+      wr = (char)wr;
+      wi = (char)wi;
+      tr = ((wr * or_) >> 7) + ((wi * oi) >> 7);
+      ti = ((wr * oi) >> 7) - ((wi * or_) >> 7);
+      /* bin k and (conjugated) bin N/2-k, twice the size */
+      xr = er + tr;
+      xi = ei + ti;
+      yr = er - tr;
+      yi = ei - ti;
+      mag[k] = ((xr < 0 ? -xr : xr) + (xi < 0 ? -xi : xi)) / 8;
+      if (mirror != k && k != 0)
+        mag[mirror] = ((yr < 0 ? -yr : yr) + (yi < 0 ? -yi : yi)) / 8;
+    }
+    return 0;
+}
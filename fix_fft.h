@@ -28,4 +28,12 @@ int fix_fft(char fr[], char fi[], int m, int inverse);
 */
 int fix_fftr(char f[], int m, int inverse);
 
+/*
+  fix_fftr_mag() - forward real FFT of 2**m samples, in place.
+  Even samples in f[0]-f[N/2-1], odd samples in f[N/2]-f[N-1];
+  replaced by the magnitudes of bins 0 to N/2-1 in f[0]-f[N/2-1]
+  (unsigned). Needs no imaginary array: N bytes for N samples.
+*/
+int fix_fftr_mag(char f[], int m);
+
 #endif
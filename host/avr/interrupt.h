@@ -0,0 +1,14 @@
+//////////////////////////////
+// avr/interrupt.h (host)
+//
+// the global interrupt flag, checked before the emulated radios run an interrupt
+// Copyright Aaron Schraner, 2018
+// 
+#ifndef HOST_INTERRUPT_H
+#define HOST_INTERRUPT_H
+#include <avr/io.h>
+
+#define sei() (SREG |= _BV(SREG_I))
+#define cli() (SREG &= ~_BV(SREG_I))
+
+#endif
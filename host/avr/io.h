@@ -0,0 +1,36 @@
+//////////////////////////////
+// avr/io.h (host)
+//
+// I/O registers as plain memory at their ATmega2560 addresses, enough for pin.h,
+// spi.h and nrf.h. outputs are mirrored into the PINx registers and the emulated
+// radios drive their IRQ pins (see nrf_sim.h)
+// Copyright Aaron Schraner, 2018
+// 
+#ifndef HOST_IO_H
+#define HOST_IO_H
+#include <stdint.h>
+
+extern volatile uint8_t host_io[0x200];
+
+#define _BV(bit) (1 << (bit))
+#define _HOST_REG(address) (host_io[address])
+
+#define PINA  _HOST_REG(0x20)
+#define DDRA  _HOST_REG(0x21)
+#define PORTA _HOST_REG(0x22)
+#define PINB  _HOST_REG(0x23)
+#define DDRB  _HOST_REG(0x24)
+#define PORTB _HOST_REG(0x25)
+#define PINC  _HOST_REG(0x26)
+#define DDRC  _HOST_REG(0x27)
+#define PORTC _HOST_REG(0x28)
+#define PIND  _HOST_REG(0x29)
+#define DDRD  _HOST_REG(0x2A)
+#define PORTD _HOST_REG(0x2B)
+#define PINL  _HOST_REG(0x109)
+#define DDRL  _HOST_REG(0x10A)
+#define PORTL _HOST_REG(0x10B)
+#define SREG  _HOST_REG(0x5F)
+#define SREG_I 7
+
+#endif
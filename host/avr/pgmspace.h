@@ -0,0 +1,21 @@
+//////////////////////////////
+// avr/pgmspace.h (host)
+//
+// program memory is ordinary memory on the host
+// Copyright Aaron Schraner, 2018
+// 
+#ifndef HOST_PGMSPACE_H
+#define HOST_PGMSPACE_H
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_byte_near(address) pgm_read_byte(address)
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_ptr(address) (*(void* const*)(address))
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+#endif
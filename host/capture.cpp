@@ -0,0 +1,228 @@
+//////////////////////////////
+// capture.cpp
+//
+// host tool that decodes the binary spectrum stream (stream_defs.h) from a serial port
+// usage: capture <device> [-b baud] [-o prefix] [-w]
+//   -b baud    serial baud rate (default 1000000)
+//   -o prefix  write <prefix>_samples.csv, <prefix>_bins.csv and <prefix>_colors.csv
+//   -w         draw a live waterfall of the FFT bins in the terminal
+// Copyright Aaron Schraner, 2018
+// 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "../crc.h"
+#include "../stream_defs.h"
+
+// decoder statistics
+struct Stats {
+    unsigned long packets, crc_errors, lost, skipped;
+    unsigned dev_dropped_packets, dev_dropped_bytes;
+};
+
+static volatile bool running = true;
+static void stop(int) { running = false; }
+
+static speed_t baud_constant(long baud) {
+    switch(baud) {
+        case 9600:    return B9600;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 500000:  return B500000;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+        default:      return 0;
+    }
+}
+
+static int open_serial(const char* device, long baud) {
+    speed_t speed = baud_constant(baud);
+    if(!speed) {
+        fprintf(stderr, "unsupported baud rate %ld\n", baud);
+        return -1;
+    }
+    int fd = open(device, O_RDONLY | O_NOCTTY);
+    if(fd < 0) {
+        perror(device);
+        return -1;
+    }
+    termios tty;
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIFLUSH);
+    return fd;
+}
+
+// one row of the waterfall, one character cell per bin
+static void draw_waterfall(const uint8_t* bins, int length, uint16_t seq) {
+    printf("%5u ", seq);
+    for(int i=0; i<length; i++) {
+        // map magnitude onto the 24-step grey ramp of the 256 color palette
+        int level = bins[i] * 4 > 255 ? 255 : bins[i] * 4;
+        printf("\033[48;5;%dm ", 232 + level * 23 / 255);
+    }
+    printf("\033[0m\n");
+}
+
+static void write_csv(FILE* f, uint16_t seq, const uint8_t* data, int length) {
+    if(!f)
+        return;
+    fprintf(f, "%u", seq);
+    for(int i=0; i<length; i++)
+        fprintf(f, ",%u", data[i]);
+    fprintf(f, "\n");
+}
+
+int main(int argc, char** argv) {
+    const char* device = 0;
+    const char* prefix = 0;
+    long baud = 1000000;
+    bool waterfall = false;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-b") && i + 1 < argc)
+            baud = atol(argv[++i]);
+        else if(!strcmp(argv[i], "-o") && i + 1 < argc)
+            prefix = argv[++i];
+        else if(!strcmp(argv[i], "-w"))
+            waterfall = true;
+        else if(argv[i][0] != '-' && !device)
+            device = argv[i];
+        else {
+            device = 0;
+            break;
+        }
+    }
+    if(!device) {
+        fprintf(stderr, "usage: %s <device> [-b baud] [-o prefix] [-w]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open_serial(device, baud);
+    if(fd < 0)
+        return 1;
+
+    FILE *samples_csv = 0, *bins_csv = 0, *colors_csv = 0;
+    if(prefix) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s_samples.csv", prefix);
+        samples_csv = fopen(name, "w");
+        snprintf(name, sizeof(name), "%s_bins.csv", prefix);
+        bins_csv = fopen(name, "w");
+        snprintf(name, sizeof(name), "%s_colors.csv", prefix);
+        colors_csv = fopen(name, "w");
+        if(!samples_csv || !bins_csv || !colors_csv) {
+            perror(prefix);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    Stats stats = {};
+    uint8_t packet[STREAM_HEADER_LENGTH + STREAM_MAX_PAYLOAD + STREAM_CRC_LENGTH];
+    int fill = 0;       // bytes of the current packet received so far
+    int expected = -1;  // next expected sequence number (-1: none yet)
+
+    uint8_t input[4096];
+    while(running) {
+        ssize_t n = read(fd, input, sizeof(input));
+        if(n <= 0)
+            break;
+
+        for(ssize_t k=0; k<n; k++) {
+            const uint8_t byte = input[k];
+
+            // hunt for the sync word
+            if(fill == 0 && byte != STREAM_SYNC0) {
+                stats.skipped++;
+                continue;
+            }
+            if(fill == 1 && byte != STREAM_SYNC1) {
+                stats.skipped++;
+                fill = byte == STREAM_SYNC0 ? 1 : 0;
+                continue;
+            }
+            packet[fill++] = byte;
+            if(fill < STREAM_HEADER_LENGTH)
+                continue;
+
+            const uint8_t type = packet[2];
+            const uint16_t seq = packet[3] | packet[4] << 8;
+            const int length = packet[5] | packet[6] << 8;
+            if(length > STREAM_MAX_PAYLOAD) {
+                // corrupt header, resynchronize
+                stats.crc_errors++;
+                fill = 0;
+                continue;
+            }
+            if(fill < STREAM_HEADER_LENGTH + length + STREAM_CRC_LENGTH)
+                continue;
+            fill = 0;
+
+            const uint8_t* payload = packet + STREAM_HEADER_LENGTH;
+            const uint16_t crc = payload[length] | payload[length + 1] << 8;
+            if(crc16(packet + 2, STREAM_HEADER_LENGTH - 2 + length) != crc) {
+                stats.crc_errors++;
+                continue;
+            }
+
+            stats.packets++;
+            if(expected >= 0)
+                stats.lost += (uint16_t)(seq - expected);
+            expected = (uint16_t)(seq + 1);
+
+            switch(type) {
+                case STREAM_SAMPLES:
+                    write_csv(samples_csv, seq, payload, length);
+                    break;
+                case STREAM_BINS:
+                    write_csv(bins_csv, seq, payload, length);
+                    if(waterfall)
+                        draw_waterfall(payload, length, seq);
+                    break;
+                case STREAM_COLORS:
+                    write_csv(colors_csv, seq, payload, length);
+                    break;
+                case STREAM_STATUS:
+                    if(length >= (int)sizeof(StreamStatus)) {
+                        StreamStatus status;
+                        memcpy(&status, payload, sizeof(status));
+                        stats.dev_dropped_packets = status.dropped_packets;
+                        stats.dev_dropped_bytes = status.dropped_bytes;
+                    }
+                    fprintf(stderr, "packets %lu, lost %lu, crc errors %lu, "
+                            "device dropped %u packets / %u bytes\n",
+                            stats.packets, stats.lost, stats.crc_errors, 
+                            stats.dev_dropped_packets, stats.dev_dropped_bytes);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    fprintf(stderr, "\n%lu packets, %lu lost, %lu crc errors, %lu bytes skipped\n", 
+            stats.packets, stats.lost, stats.crc_errors, stats.skipped);
+
+    if(samples_csv) fclose(samples_csv);
+    if(bins_csv) fclose(bins_csv);
+    if(colors_csv) fclose(colors_csv);
+    close(fd);
+    return 0;
+}
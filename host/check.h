@@ -0,0 +1,32 @@
+//////////////////////////////
+// check.h
+//
+// pass/fail checks for the host benches
+// Copyright Aaron Schraner, 2018
+//
+// each check prints a line with ok or FAILED, main() returns check_summary()
+// so a bench exits with 1 if any of them failed.
+//
+
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+#include <stdio.h>
+
+static int failures = 0;
+
+inline void check(bool condition, const char* what) {
+    printf("  %-44s %s\n", what, condition ? "ok" : "FAILED");
+    if(!condition)
+        failures++;
+}
+
+// print the result of all checks, returns the exit code
+inline int check_summary() {
+    if(failures)
+        printf("%d check(s) failed\n", failures);
+    else
+        puts("all checks passed");
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+//////////////////////////////
+// eeprom_sim.cpp
+//
+// simulated EEPROM for host builds
+// Copyright Aaron Schraner, 2018
+// 
+
+#include <stdio.h>
+#include <string.h>
+#include "../eeprom.h"
+#include "eeprom_sim.h"
+
+static const uint32_t write_time = 3400; // us per byte (erase and write)
+
+static uint8_t memory[EEPROM_SIZE];
+static uint32_t write_count[EEPROM_SIZE];
+static uint32_t busy_for = 0; // us until the current write completes
+static bool initialized = false;
+
+static void init() {
+    if(initialized)
+        return;
+    memset(memory, 0xFF, sizeof(memory));
+    initialized = true;
+}
+
+bool ee_ready() {
+    return busy_for == 0;
+}
+
+uint8_t ee_read(uint16_t address) {
+    init();
+    // the hardware stalls reads until a write finishes
+    busy_for = 0;
+    return memory[address % EEPROM_SIZE];
+}
+
+void ee_write(uint16_t address, uint8_t value) {
+    init();
+    memory[address % EEPROM_SIZE] = value;
+    write_count[address % EEPROM_SIZE]++;
+    busy_for = write_time;
+}
+
+bool eeprom_sim_load(const char* filename) {
+    init();
+    FILE* f = fopen(filename, "rb");
+    if(!f)
+        return false;
+    fread(memory, 1, sizeof(memory), f);
+    fclose(f);
+    return true;
+}
+
+bool eeprom_sim_save(const char* filename) {
+    FILE* f = fopen(filename, "wb");
+    if(!f)
+        return false;
+    fwrite(memory, 1, sizeof(memory), f);
+    fclose(f);
+    return true;
+}
+
+void eeprom_sim_advance(uint32_t us) {
+    busy_for = us >= busy_for ? 0 : busy_for - us;
+}
+
+uint32_t eeprom_sim_writes(uint16_t address) {
+    return write_count[address % EEPROM_SIZE];
+}
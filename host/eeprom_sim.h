@@ -0,0 +1,22 @@
+//////////////////////////////
+// eeprom_sim.h
+//
+// simulated EEPROM backing ee_ready()/ee_read()/ee_write() (eeprom.h) on the host
+// Copyright Aaron Schraner, 2018
+// 
+#ifndef EEPROM_SIM_H
+#define EEPROM_SIM_H
+#include <stdint.h>
+
+// load an EEPROM image (e.g. read with avrdude -U eeprom:r:file:r)
+// a missing file leaves the EEPROM erased (all 0xFF)
+bool eeprom_sim_load(const char* filename);
+bool eeprom_sim_save(const char* filename);
+
+// let <us> microseconds of simulated time pass (a byte write takes 3400us)
+void eeprom_sim_advance(uint32_t us);
+
+// number of times the byte at <address> has been written
+uint32_t eeprom_sim_writes(uint16_t address);
+
+#endif
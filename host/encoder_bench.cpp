@@ -0,0 +1,217 @@
+//////////////////////////////
+// encoder_bench.cpp
+//
+// checks the remote's encoder state machine (remote/encoder.cpp) against clean turns,
+// contact bounce and impossible transitions, then estimates how long the remote is
+// awake per detent with the decoder in the pin change interrupt (radio from nrf_sim.h).
+// also checks the base's knob acceleration curve (acceleration.h) against its limits.
+// exits with 1 if any of the checks fail.
+// Copyright Aaron Schraner, 2018
+//
+// usage: ./encoder_bench [cycles per edge interrupt]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "../remote/encoder.h"
+#include "../remote/knob_link.h"
+#include "../nrf.h"
+#include "../remote_protocol.h"
+#include "../acceleration.h"
+#include "nrf_sim.h"
+#include "check.h"
+
+// encoder states in clockwise order (A << 1 | B)
+const uint8_t phases[4] = { 3, 1, 0, 2 };
+
+// steps counted like remote/main.cpp's change_volume()
+int steps = 0, callbacks = 0;
+void count_step(int8_t increment, uint8_t edge_id) {
+    callbacks++;
+    if(edge_id == 0)
+        steps += increment;
+}
+
+// feed the encoder the states of a phase position (one interrupt per change)
+struct Knob {
+    Encoder encoder;
+    int position; // phases, 4 per detent
+    Knob(): encoder(count_step), position(0) {
+        encoder.update(phases[0]);
+    }
+    void move(int phases_moved) {
+        const int direction = phases_moved > 0 ? 1 : -1;
+        for(int i = 0; i != phases_moved; i += direction) {
+            position += direction;
+            encoder.update(phases[position & 3]);
+        }
+    }
+    // steps expected after the moves so far: the counting edge sits between
+    // phase 0 and phase 1 of every detent
+    int expected(int sign) const {
+        const int p = position + 3;
+        return sign * (p >= 0 ? p / 4 : -((-p + 3) / 4));
+    }
+};
+
+void bench_state_machine() {
+    puts("state machine");
+    Knob knob;
+    knob.move(4);
+    const int sign = steps; // direction convention of the tables
+    check(steps == 1 || steps == -1, "one step per clockwise detent");
+    knob.move(-4);
+    check(steps == 0, "counter-clockwise detent undoes it");
+
+    // bouncing contact on every edge of 10 detents
+    steps = 0;
+    for(int d = 0; d < 10; d++)
+        for(int e = 0; e < 4; e++) {
+            knob.move(1);
+            for(int b = 0; b < 3; b++) {
+                knob.move(-1);
+                knob.move(1);
+            }
+        }
+    check(steps == 10 * sign, "contact bounce doesn't add steps");
+
+    // half a detent and back
+    steps = 0;
+    knob.move(2);
+    knob.move(-2);
+    check(steps == 0, "half a detent and back counts nothing");
+
+    // both contacts changing at once (missed edge): ignored
+    callbacks = 0;
+    knob.encoder.update(phases[(knob.position + 2) & 3]);
+    knob.encoder.update(phases[knob.position & 3]);
+    check(callbacks == 0, "impossible transitions are ignored");
+
+    // random walk
+    steps = 0;
+    Knob walk;
+    srand(1);
+    for(int i = 0; i < 100000; i++)
+        walk.move(rand() % 2 ? 1 : -1);
+    check(steps == walk.expected(sign), "random walk matches the knob position");
+}
+
+// remote and base radios, the base only acknowledges and empties its RX FIFO
+Pin base_irq(PORTL, 0, INPUT), base_ce(PORTL, 1, OUTPUT), base_cs(PORTB, 0, OUTPUT);
+Pin remote_irq(PORTD, 2, INPUT), remote_ce(PORTB, 1, OUTPUT), remote_cs(PORTB, 2, OUTPUT);
+NRFSim base_radio(base_cs, base_ce, base_irq),
+       remote_radio(remote_cs, remote_ce, remote_irq);
+NRF base(base_irq, base_ce, base_cs),
+    remote(remote_irq, remote_ce, remote_cs);
+
+const uint8_t remote_address[6] = "2Node";
+const uint8_t station_address[6] = "1Node";
+
+// the remote's knob packets (knob_link.h) with the encoder's pending steps
+KnobLink knob_link(remote, 76);
+volatile int8_t pending_steps = 0;
+volatile uint32_t pending_since = 0;
+void knob_sent(bool success, uint8_t retransmits) {
+    knob_link.sent(success, retransmits, sim_micros());
+}
+
+// one packet per detent, 20ms apart like a slow turn
+void bench_active_time(uint32_t isr_cycles) {
+    const uint32_t f_cpu = 1000000; // remote/Makefile
+    const uint32_t spi_us = 16;     // SCK = F_CPU/2, 8 bits
+    printf("remote active time per detent (1MHz, %u cycles per edge interrupt)\n", (unsigned)isr_cycles);
+    sim_set_spi_time(spi_us);
+    base.init(76);
+    base.setup_rx_pipe(1, station_address, 1);
+    base.enable_dynamic_payloads(_BV(DPL_P1));
+    base.start_listening();
+    remote.init(76);
+    remote.set_tx_addr(station_address);
+    remote.setup_rx_pipe(1, remote_address, 1);
+    remote.enable_dynamic_payloads(_BV(DPL_P0));
+    remote.set_clock(sim_micros);
+    remote.power_down();
+    sei();
+
+    const int detents = 50;
+    uint32_t radio_on = 0, spi_bytes = remote_radio.spi_bytes;
+    for(int d = 0; d < detents; d++) {
+        // the counting edge wakes the MCU, send right away and idle until the ACK
+        const uint32_t start = sim_micros();
+        pending_steps = 1;
+        pending_since = start;
+        do
+            knob_link.send(pending_steps, pending_since, knob_sent);
+        while(knob_link.due(pending_steps) && (sim_advance(10), true));
+        knob_link.sleep();
+        remote.power_down();
+        radio_on += sim_micros() - start;
+        sim_advance(20000);
+        while(base.available()) {
+            uint8_t packet[32];
+            base.read(packet);
+        }
+    }
+    const uint32_t edges_us = 4 * isr_cycles * 1000000 / f_cpu;
+    const uint32_t spi_per_detent = (remote_radio.spi_bytes - spi_bytes) / detents;
+    const uint32_t running = edges_us + spi_per_detent * spi_us;
+    const uint32_t awake = edges_us + radio_on / detents;
+    printf("  4 edge interrupts %uus, %u SPI bytes (%uus)\n",
+            (unsigned)edges_us, (unsigned)spi_per_detent, (unsigned)(spi_per_detent * spi_us));
+    printf("  CPU running %uus, awake (idle while sending) %uus, radio powered %uus\n",
+            (unsigned)running, (unsigned)awake, (unsigned)(radio_on / detents));
+    printf("  polling design: ~30000us running, radio powered ~2s per wake\n");
+    check(remote.tx_stats().sent == detents, "every detent is acknowledged");
+    check(awake < 5000, "awake well under the old 30ms per wake");
+}
+
+// volume steps for one detent of a knob turning at <rate> detents per second, after
+// the rate has settled
+int16_t accelerated(uint8_t accel, uint8_t threshold, uint8_t max, uint16_t rate) {
+    Settings settings = default_settings;
+    settings.accel = accel;
+    settings.accel_threshold = threshold;
+    settings.accel_max = max;
+    Acceleration acceleration;
+    int16_t steps = 0;
+    for(uint16_t i = 0; i < 16; i++)
+        steps = acceleration.steps(1, i * 1000 / rate, 3, settings);
+    return steps;
+}
+
+// 16 detents at <rate> per second, timed by the remote's clock or by their arrival.
+// the remote's timer0 stops in power down, it only counts the <awake> ms per detent
+int16_t knob_steps(uint16_t rate, uint16_t awake, bool by_arrival) {
+    const Settings settings = default_settings;
+    Acceleration acceleration;
+    int16_t steps = 0;
+    for(uint16_t i = 0; i < 16; i++)
+        steps = acceleration.steps(1, by_arrival ? i * 1000 / rate : i * awake, 3, settings);
+    return steps;
+}
+
+void bench_acceleration() {
+    puts("acceleration (3 volume steps per detent)");
+    for(uint16_t rate = 5; rate <= 100; rate *= 4)
+        printf("  %3u detents/s: accmax 1 %3d, accmax 4 %3d, accmax 16 %3d\n", rate,
+                accelerated(8, 8, 1, rate), accelerated(8, 8, 4, rate), accelerated(8, 8, 16, rate));
+    check(accelerated(8, 8, 8, 5) == 3, "below accthr every detent is 3 steps");
+    check(accelerated(8, 8, 1, 10) == 3 && accelerated(255, 8, 1, 100) == 3,
+            "accmax 1 never accelerates");
+    check(accelerated(255, 8, 4, 100) == 12, "the multiplier stops at accmax");
+    printf("  5 detents/s, remote awake 3ms each: remote clock %d steps, arrival %d steps\n",
+            knob_steps(5, 3, false), knob_steps(5, 3, true));
+    check(knob_steps(5, 3, true) == 3, "a slow turn timed by arrival stays precise");
+}
+
+int main(int argc, char** argv) {
+    // prologue/epilogue, pin reads, table lookups and the step callback
+    const uint32_t isr_cycles = argc > 1 ? atoi(argv[1]) : 150;
+    bench_state_machine();
+    bench_active_time(isr_cycles);
+    bench_acceleration();
+    return check_summary();
+}
@@ -0,0 +1,585 @@
+//////////////////////////////
+// nrf_bench.cpp
+//
+// runs nrf.h against emulated radios (nrf_sim.h) and reports SPI traffic, air time
+// and latency of the remote protocol, the command path, broadcasts and the channel
+// survey. exits with 1 if any of the checks fail.
+// Copyright Aaron Schraner, 2018
+//
+// usage: ./nrf_bench [loss percent]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "../nrf.h"
+#include "../remote_protocol.h"
+#include "../broadcast.h"
+#include "../settings.h"
+#include "../command.h"
+#include "../channel_survey.h"
+#include "../base_link.h"
+#include "../remote/knob_link.h"
+#include "nrf_sim.h"
+#include "check.h"
+
+// pins of the three nodes (any free pins will do, each radio needs its own)
+Pin base_irq(PORTL, 0, INPUT), base_ce(PORTL, 1, OUTPUT), base_cs(PORTB, 0, OUTPUT);
+Pin remote_irq(PORTD, 2, INPUT), remote_ce(PORTD, 3, OUTPUT), remote_cs(PORTD, 4, OUTPUT);
+Pin slave_irq(PORTC, 0, INPUT), slave_ce(PORTC, 1, OUTPUT), slave_cs(PORTC, 2, OUTPUT);
+
+NRFSim base_radio(base_cs, base_ce, base_irq),
+       remote_radio(remote_cs, remote_ce, remote_irq),
+       slave_radio(slave_cs, slave_ce, slave_irq);
+
+NRF base(base_irq, base_ce, base_cs),
+    remote(remote_irq, remote_ce, remote_cs),
+    slave(slave_irq, slave_ce, slave_cs);
+
+const uint8_t remote_address[6] = "2Node";
+const uint8_t station_address[6] = "1Node";
+const uint8_t broadcast_address[6] = "BNode";
+
+// SPI bytes and simulated time of an operation
+struct Cost {
+    const NRFSim& radio;
+    const char* name;
+    uint32_t bytes, start;
+    Cost(const NRFSim& radio, const char* name):
+        radio(radio), name(name), bytes(radio.spi_bytes), start(sim_micros()) {}
+    ~Cost() {
+        printf("  %-32s %5u SPI bytes %7u us\n", name,
+                (unsigned)(radio.spi_bytes - bytes), (unsigned)(sim_micros() - start));
+    }
+};
+
+// command parser output (PSTR strings are ordinary strings on the host)
+struct HostOutput {
+    char text[256];
+    HostOutput() { text[0] = 0; }
+    void printf_P(const char* format, ...) {
+        char host_format[64];
+        strncpy(host_format, format, sizeof(host_format) - 1);
+        host_format[sizeof(host_format) - 1] = 0;
+        for(char* c = host_format; *c; c++)
+            if(c[0] == '%' && c[1] == 'S')
+                c[1] = 's';
+        va_list args;
+        va_start(args, format);
+        const size_t used = strlen(text);
+        vsnprintf(text + used, sizeof(text) - used, host_format, args);
+        va_end(args);
+    }
+};
+
+// base station state: the remote protocol is base_link.h, like main.cpp
+Settings settings = default_settings;
+HostOutput output;
+CommandParser<HostOutput> commands(output, settings, 0);
+uint32_t knob_sent_at = 0;  // when the remote queued the packet being measured
+uint32_t knob_applied_at = 0;
+
+void base_isr() {
+    base.interrupt();
+}
+
+// the rest of the base (see base_link.h), volume steps are counted in <steps>
+struct BenchNode {
+    int16_t steps;
+    uint8_t quietest;   // what the survey would find (0: stay)
+    uint8_t broadcasts; // frames on pipe 2
+    BenchNode(): steps(0), quietest(0), broadcasts(0) {}
+    void move(int16_t count) { steps += count; }
+    int16_t position() const { return steps; }
+    bool movable() const { return true; }
+    bool key(uint8_t value) { return commands.feed(value) >= 0; }
+    void broadcast(const uint8_t* packet, uint8_t length) { broadcasts++; }
+    uint8_t rescan() { return quietest == settings.channel ? 0 : quietest; }
+    void switch_channel(uint8_t channel) {
+        settings.channel = channel;
+        base.set_freq(channel);
+    }
+    void knob(const KnobPacket& knob, int16_t count) { knob_applied_at = sim_micros(); }
+} node;
+BaseLink<BenchNode> link(base, node, settings);
+
+// the remote: knob_link.h with the encoder's pending steps, like remote/main.cpp
+KnobLink knob_link(remote, 76);
+volatile int8_t pending_steps = 0;
+volatile uint32_t pending_since = 0;
+bool last_success;
+void remote_done(bool success, uint8_t retransmits) {
+    last_success = success;
+}
+void knob_sent(bool success, uint8_t retransmits) {
+    last_success = success;
+    knob_link.sent(success, retransmits, sim_micros());
+}
+
+// encoder steps for the remote
+void turn(int8_t steps) {
+    if(!pending_steps)
+        pending_since = sim_micros();
+    pending_steps += steps;
+}
+
+// the base's handle_radio()
+void base_poll() {
+    link.poll(sim_micros() / 1000);
+}
+
+// the base's main loop handles packets every <poll_interval> us
+uint32_t poll_interval = 1000, next_poll = 0;
+void base_step() {
+    if((int32_t)(sim_micros() - next_poll) >= 0) {
+        base_poll();
+        next_poll = sim_micros() + poll_interval;
+    }
+}
+
+// run both nodes until the remote's transmission is done
+void run_remote() {
+    while(remote.tx_busy()) {
+        remote.service();
+        base_step();
+        sim_advance(10);
+    }
+}
+
+// let the base handle what it received
+void run_base() {
+    sim_advance(poll_interval);
+    base_step();
+}
+
+// worst step latency of bench_spin(), [legacy]
+uint32_t spin_max[2];
+
+// run the remote until its pending steps are acknowledged (or it gave up)
+void send_knob() {
+    knob_link.send(pending_steps, pending_since, knob_sent);
+    while(knob_link.due(pending_steps)) {
+        knob_link.send(pending_steps, pending_since, knob_sent);
+        base_step();
+        sim_advance(10);
+    }
+    knob_link.sleep(); // the remote powers down until the next edge
+}
+
+void setup() {
+    puts("setup");
+    {
+        Cost c(base_radio, "base init");
+        base.init(76);
+        base.setup_rx_pipe(1, station_address, 1);
+        base.enable_dynamic_payloads(_BV(DPL_P1));
+    }
+    {
+        Cost c(base_radio, "base start_listening");
+        base.start_listening();
+    }
+    base.enable_irq();
+    base.set_clock(sim_micros);
+    base_radio.attach_interrupt(base_isr);
+    settings.accel_max = 1; // 3 volume steps per encoder step, to compare positions
+    link.load_status();
+    {
+        Cost c(remote_radio, "remote init");
+        remote.init(76);
+        remote.set_tx_addr(station_address);
+        remote.setup_rx_pipe(1, remote_address, 1);
+        remote.enable_dynamic_payloads(_BV(DPL_P0));
+    }
+    remote.set_clock(sim_micros);
+    sei();
+}
+
+void bench_knob(uint8_t loss, uint32_t poll) {
+    printf("knob packets, %u%% loss, base polls every %uus\n", loss, (unsigned)poll);
+    sim_set_loss(loss);
+    poll_interval = poll;
+    next_poll = sim_micros();
+    const NRF::TxStats before = remote.tx_stats();
+    const uint32_t bytes = remote_radio.spi_bytes, base_bytes = base_radio.spi_bytes,
+                   air = remote_radio.air_time;
+    const int16_t start = node.steps;
+    int16_t turned = 0;
+    uint32_t latency_total = 0, latency_max = 0, applied = 0, status_current = 0;
+    const int packets = 200;
+    for(int i = 0; i < packets; i++) {
+        const int8_t delta = i % 6 < 3 ? i % 6 - 3 : i % 6 - 2; // -3 to 3, not 0
+        turned += delta;
+        turn(delta);
+        knob_sent_at = sim_micros();
+        const uint32_t applied_before = knob_applied_at;
+        send_knob();
+        // until the base got around to it
+        for(int t = 0; t < 100 && knob_applied_at == applied_before; t++) {
+            base_step();
+            sim_advance(500);
+        }
+        if(knob_applied_at != applied_before) {
+            const uint32_t latency = knob_applied_at - knob_sent_at;
+            latency_total += latency;
+            latency_max = latency > latency_max ? latency : latency_max;
+            applied++;
+        }
+        // the ACK carries the status loaded after the previous packet (or after
+        // this one, to a retransmission)
+        if((uint8_t)(knob_link.packet().seq - knob_link.base_status().seq) <= 1)
+            status_current++;
+        sim_advance(5000 + i * 7919 % 20000); // spread the phase against the base's polling
+    }
+    const NRF::TxStats& stats = remote.tx_stats();
+    const uint16_t sent = stats.sent - before.sent, failed = stats.failed - before.failed;
+    printf("  knob to base: mean %uus max %uus (%u applied), %u current statuses back\n",
+            (unsigned)(applied ? latency_total / applied : 0), (unsigned)latency_max, (unsigned)applied,
+            (unsigned)status_current);
+    printf("  remote: %u acked, %u failed, %u retransmits, mean TX latency %uus\n",
+            sent, failed, stats.retransmits - before.retransmits,
+            (unsigned)((stats.total_latency - before.total_latency) / (sent + failed ? sent + failed : 1)));
+    printf("  SPI bytes per packet: remote %u, base %u; air time %uus per packet\n",
+            (unsigned)((remote_radio.spi_bytes - bytes) / packets),
+            (unsigned)((base_radio.spi_bytes - base_bytes) / packets),
+            (unsigned)((remote_radio.air_time - air) / packets));
+    check(node.steps - start == 3 * turned, "base position matches the remote's steps");
+    check(status_current >= packets / 2, "ACK payloads bring the base's status");
+    sim_set_loss(0);
+}
+
+// a fast spin of the knob: <detents> steps <gap> us apart, each timed from its detent
+// to the base applying it. legacy models the protocol before KnobPacket: a 1-byte '+'
+// packet per step, and a base that checks the radio once per 25ms analysis frame and
+// then spends 20ms on key feedback. otherwise the remote coalesces the steps like
+// remote/main.cpp and the base polls every 1ms.
+void bench_spin(bool legacy, uint8_t detents, uint32_t gap) {
+    printf("spin of %u steps %uus apart, %s\n", detents, (unsigned)gap,
+            legacy ? "1-byte packet per step, base checks once per frame" : "knob packets");
+    const uint32_t frame = 25000, feedback = 20000;
+    poll_interval = 1000;
+    uint32_t at[64];
+    uint8_t steps = 0, pending = 0, applied = 0, legacy_applied = 0;
+    uint32_t latency_total = 0, latency_max = 0;
+    const int16_t start_steps = node.steps;
+    const NRF::TxStats before = remote.tx_stats();
+    const uint32_t start = sim_micros();
+    uint32_t next_check = start;
+    next_poll = start;
+    if(legacy)
+        base.disable_irq(); // the old base polled the radio
+    while(applied < detents && sim_micros() - start < detents * gap + 1000000) {
+        const uint32_t now = sim_micros();
+        if(steps < detents && now - start >= steps * gap) {
+            at[steps++] = now;
+            if(legacy)
+                pending++;
+            else
+                turn(1);
+        }
+
+        // remote
+        if(legacy) {
+            remote.service();
+            if(!remote.tx_busy() && pending) {
+                const uint8_t plus = '+';
+                remote.send_async(&plus, 1, remote_done);
+                pending--; // a failed packet was lost
+            }
+        }
+        else
+            knob_link.send(pending_steps, pending_since, knob_sent);
+
+        // base
+        if(legacy) {
+            if((int32_t)(now - next_check) >= 0) {
+                next_check = now + frame;
+                if(base.available()) {
+                    uint8_t packet[32];
+                    if(base.read(packet) == 1 && packet[0] == '+')
+                        legacy_applied++;
+                    next_check += feedback;
+                }
+            }
+        }
+        else
+            base_step();
+
+        const uint8_t done = legacy ? legacy_applied : (node.steps - start_steps) / 3;
+        for(; applied < done; applied++) {
+            const uint32_t latency = now - at[applied];
+            latency_total += latency;
+            latency_max = latency > latency_max ? latency : latency_max;
+        }
+        sim_advance(10);
+    }
+    const NRF::TxStats& stats = remote.tx_stats();
+    printf("  step to base: mean %uus max %uus, %u of %u applied; %u packets acked, %u failed\n",
+            (unsigned)(applied ? latency_total / applied : 0), (unsigned)latency_max,
+            applied, detents, stats.sent - before.sent, stats.failed - before.failed);
+    // settle (the remote's last ACK, the legacy base's queue)
+    for(int t = 0; t < 100; t++) {
+        if(legacy)
+            remote.service();
+        else
+            knob_link.send(pending_steps, pending_since, knob_sent);
+        base_step();
+        sim_advance(1000);
+    }
+    if(legacy) {
+        while(base.available()) {
+            uint8_t packet[32];
+            base.read(packet);
+        }
+        base.enable_irq();
+        link.load_status(); // polling read the ACK payload's slot empty
+    }
+    else {
+        knob_link.sleep();
+        check(applied == detents && latency_max < 5000, "every step applied within 5ms");
+    }
+    spin_max[legacy] = latency_max;
+}
+
+// knob packets on a bad channel until the remote asks for a rescan, then idle for
+// <idle> us before its next packets: both have to end up on <target> however long
+// that takes. returns false if any of it went wrong
+bool move_channel(uint8_t target, uint32_t idle, bool report) {
+    const int16_t start = node.steps;
+    int16_t turned = 0;
+    node.quietest = target;
+    sim_set_loss(60);
+    for(int i = 0; i < 50; i++) {
+        turn(1);
+        turned++;
+        send_knob();
+        run_base();
+        if(knob_link.packet().flags & KNOB_RESCAN)
+            break;
+    }
+    sim_set_loss(0);
+    const bool asked = knob_link.packet().flags & KNOB_RESCAN;
+    // (the announcement may have reached the remote already, with a retransmission)
+    const uint8_t base_before = base.channel(), remote_before = knob_link.channel();
+    for(uint32_t t = 0; t < idle; t += 1000) {
+        base_step();
+        sim_advance(1000);
+    }
+    const bool waited = base.channel() == base_before && knob_link.channel() == remote_before;
+    for(int i = 0; i < 2; i++) {
+        turn(1);
+        turned++;
+        send_knob();
+        run_base();
+    }
+    const bool moved = knob_link.channel() == target && base.channel() == target;
+    node.quietest = 0;
+    if(report) {
+        check(asked, "retransmissions make the remote ask");
+        check(waited, "base and remote stay together");
+        check(moved, "both move to the new channel");
+        check(node.steps - start == 3 * turned, "no step lost on the way");
+    }
+    return asked && waited && moved && node.steps - start == 3 * turned;
+}
+
+void bench_channel_move(uint32_t idle) {
+    printf("channel move, remote idle for %ums\n", (unsigned)(idle / 1000));
+    poll_interval = 1000;
+    next_poll = sim_micros();
+    const uint8_t home = settings.channel;
+    move_channel(40, idle, true);
+    check(move_channel(home, 0, false), "and back home");
+}
+
+void bench_commands() {
+    puts("command path");
+    const char* set = ":bright=9;";
+    const char* get = ":bright;";
+    poll_interval = 1000;
+    next_poll = sim_micros();
+    remote.send_async((const uint8_t*)set, strlen(set));
+    run_remote();
+    run_base();
+    output.text[0] = 0;
+    remote.send_async((const uint8_t*)get, strlen(get));
+    run_remote();
+    run_base();
+    check(settings.brightness == 9, "set over the radio");
+    check(!strcmp(output.text, "bright=9\n"), "get over the radio");
+}
+
+// the master reloads the remote's ACK payload that send_async() flushed
+void broadcast_sent(bool success, uint8_t retransmits) {
+    link.load_status();
+}
+
+void bench_broadcast(uint8_t loss) {
+    printf("broadcast, %u%% loss\n", loss);
+    slave.init(76);
+    slave.setup_rx_pipe(1, station_address, 1);
+    slave.setup_rx_pipe(2, broadcast_address, BROADCAST_FRAME_SIZE);
+    slave.start_listening();
+    base.set_tx_addr(broadcast_address, BROADCAST_FRAME_SIZE);
+    sim_set_loss(loss);
+    link.load_status();
+
+    const int frames = 100;
+    uint32_t received = 0, error = 0;
+    const uint32_t bytes = base_radio.spi_bytes;
+    for(int f = 0; f < frames; f++) {
+        uint8_t values[BROADCAST_VALUES], frame[BROADCAST_FRAME_SIZE];
+        for(uint8_t i = 0; i < BROADCAST_VALUES; i++)
+            values[i] = (uint8_t)(128 + 100 * ((i * 7 + f * 3) % 23 - 11) / 11);
+        broadcast_encode(frame, f, values);
+        // like main.cpp: a status for the remote is always waiting in the TX FIFO
+        base.send_async(frame, sizeof(frame), broadcast_sent, false);
+        while(base.tx_busy()) {
+            base.service();
+            sim_advance(10);
+        }
+        while(slave.available()) {
+            uint8_t packet[32], decoded[BROADCAST_VALUES], seq;
+            const uint8_t length = slave.read(packet);
+            if(broadcast_decode(packet, length, decoded, &seq) && seq == (uint8_t)f) {
+                received++;
+                for(uint8_t i = 0; i < BROADCAST_VALUES; i++)
+                    error += abs(decoded[i] - values[i]);
+            }
+        }
+        sim_advance(20000);
+    }
+    printf("  %u/%u frames received, mean error %.2f, %u SPI bytes per frame (master)\n",
+            (unsigned)received, frames, received ? (double)error / received / BROADCAST_VALUES : 0.0,
+            (unsigned)((base_radio.spi_bytes - bytes) / frames));
+    check(loss ? received > 0 : received == (uint32_t)frames, "slave receives the frames");
+    sim_set_loss(0);
+}
+
+// a knob packet read while a broadcast is on the air: its status must not go into
+// the TX FIFO in TX mode, broadcast_sent() loads it
+void bench_broadcast_knob() {
+    puts("knob packet handled during a broadcast");
+    // master mode: the broadcast address stays the TX address
+    base.start_listening();
+    link.load_status();
+    base.set_tx_addr(broadcast_address, BROADCAST_FRAME_SIZE);
+
+    // the packet waits in the base's RX FIFO until the broadcast has started
+    turn(1);
+    knob_link.send(pending_steps, pending_since, knob_sent);
+    while(remote.tx_busy()) {
+        remote.service();
+        sim_advance(10);
+    }
+    uint8_t values[BROADCAST_VALUES] = {}, frame[BROADCAST_FRAME_SIZE];
+    broadcast_encode(frame, 0, values);
+    const uint32_t sent = base_radio.sent;
+    const int16_t start = node.steps;
+    base.send_async(frame, sizeof(frame), broadcast_sent, false);
+    base_poll();
+    while(base.tx_busy()) {
+        base.service();
+        sim_advance(10);
+    }
+    check(node.steps - start == 3, "the packet is applied");
+    check(base_radio.sent - sent == 1, "no ACK payload goes out as a packet");
+
+    // each ACK carries the status loaded after the remote's previous packet
+    bool current = true;
+    for(int i = 0; i < 3; i++) {
+        turn(1);
+        send_knob();
+        run_base();
+        current = current && knob_link.base_status().seq == (uint8_t)(knob_link.packet().seq - 1);
+    }
+    check(current, "one status waiting for the remote");
+}
+
+// the remote after a reset, counting from seq 1 again
+KnobLink* restarted = 0;
+void restarted_sent(bool success, uint8_t retransmits) {
+    restarted->sent(success, retransmits, sim_micros());
+}
+
+void bench_remote_reset() {
+    puts("remote reset");
+    // the base applied seq 1 last
+    for(int i = 0; i < 256 && knob_link.packet().seq != 1; i++) {
+        turn(1);
+        send_knob();
+        run_base();
+    }
+    KnobLink link_after_reset(remote, 76);
+    restarted = &link_after_reset;
+    const int16_t start = node.steps;
+    turn(1);
+    link_after_reset.send(pending_steps, pending_since, restarted_sent);
+    while(link_after_reset.due(pending_steps)) {
+        link_after_reset.send(pending_steps, pending_since, restarted_sent);
+        base_step();
+        sim_advance(10);
+    }
+    run_base();
+    check(link_after_reset.packet().seq == 1 && (link_after_reset.packet().flags & KNOB_FIRST),
+            "the first packet after a reset is flagged");
+    check(node.steps - start == 3, "and applied although the base had its seq");
+    link.handle_knob(link_after_reset.packet(), sim_micros() / 1000);
+    check(node.steps - start == 3, "a retransmission of it is not");
+    turn(1);
+    link_after_reset.send(pending_steps, pending_since, restarted_sent);
+    while(link_after_reset.due(pending_steps)) {
+        link_after_reset.send(pending_steps, pending_since, restarted_sent);
+        base_step();
+        sim_advance(10);
+    }
+    run_base();
+    check(!(link_after_reset.packet().flags & KNOB_FIRST) && node.steps - start == 6,
+            "later packets count as usual");
+}
+
+void bench_survey() {
+    puts("channel survey");
+    for(uint8_t c = CHANNEL_MIN; c <= 30; c++)
+        sim_set_noise(c, 60); // wifi
+    for(uint8_t c = 40; c <= 62; c++)
+        sim_set_noise(c, 30);
+    sim_set_noise(72, 50);
+
+    ChannelSurvey survey;
+    const uint32_t bytes = slave_radio.spi_bytes, start = sim_micros();
+    while(!survey.complete())
+        survey.step(slave, 76);
+    for(int sweep = 0; sweep < 3; sweep++)
+        for(uint8_t c = CHANNEL_MIN; c <= CHANNEL_MAX; c++)
+            survey.step(slave, 76);
+    const uint16_t steps = (CHANNEL_MAX - CHANNEL_MIN + 1) * 4;
+    printf("  %u SPI bytes, %uus per step; quietest channel %u\n",
+            (unsigned)((slave_radio.spi_bytes - bytes) / steps),
+            (unsigned)((sim_micros() - start) / steps), survey.quietest());
+    const uint8_t q = survey.quietest();
+    check(q > 30 && (q < 40 || q > 62) && q != 72, "quietest channel avoids the noise");
+    check(slave.channel() == 76, "returns to the home channel");
+}
+
+int main(int argc, char** argv) {
+    const uint8_t loss = argc > 1 ? atoi(argv[1]) : 10;
+    setup();
+    bench_knob(0, 1000);
+    bench_knob(loss, 1000);
+    bench_knob(0, 25000); // once per frame, like the base used to
+    bench_channel_move(2000000);
+    bench_spin(true, 12, 5000);
+    bench_spin(false, 12, 5000);
+    check(spin_max[false] < spin_max[true], "coalesced knob packets beat the old path");
+    bench_commands();
+    bench_broadcast_knob();
+    bench_broadcast(0);
+    bench_broadcast(loss);
+    bench_remote_reset(); // last: the bench's remote is out of step with the base after it
+    bench_survey();
+    return check_summary();
+}
@@ -0,0 +1,578 @@
+//////////////////////////////
+// nrf_sim.cpp
+//
+// nRF24L01+ emulator and the host SPI backend (see nrf_sim.h)
+// Copyright Aaron Schraner, 2018
+//
+
+#include <string.h>
+#include <avr/interrupt.h>
+#include "../spi.h"
+#include "../nrf_defs.h"
+#include "nrf_sim.h"
+
+volatile uint8_t host_io[0x200];
+
+static NRFSim* radios[8];
+static uint8_t radio_count = 0;
+static NRFSim* selected[8]; // radios with CS low, innermost (latest) last
+static uint8_t selected_count = 0;
+
+static uint32_t now = 0;
+static uint8_t loss = 0;
+static uint8_t noise[128];
+static uint8_t spi_time = 2;
+static uint32_t random_state = 0x12345678;
+
+// xorshift, deterministic so runs can be compared
+static bool chance(uint8_t percent) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % 100 < percent;
+}
+
+// PINx follows PORTx for outputs
+static void sync_pins() {
+    static const uint16_t ports[] = { 0x20, 0x23, 0x26, 0x29, 0x109 };
+    for(uint8_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+        const uint8_t ddr = host_io[ports[i] + 1];
+        host_io[ports[i]] = (host_io[ports[i]] & ~ddr) | (host_io[ports[i] + 2] & ddr);
+    }
+}
+
+// run pending interrupts if they are enabled
+static void dispatch() {
+    for(uint8_t i = 0; i < radio_count; i++) {
+        if(!(SREG & _BV(SREG_I)))
+            return;
+        if(radios[i]->take_interrupt()) {
+            // like the hardware, interrupts are disabled inside an ISR
+            cli();
+            sync_pins();
+            radios[i]->isr_call();
+            sei();
+        }
+    }
+}
+
+static NRFSim* find(const Pin& pin) {
+    for(uint8_t i = 0; i < radio_count; i++)
+        if(radios[i]->owns(pin))
+            return radios[i];
+    return 0;
+}
+
+uint32_t sim_micros() {
+    return now;
+}
+
+void sim_advance(uint32_t us) {
+    while(us--) {
+        now++;
+        sync_pins();
+        for(uint8_t i = 0; i < radio_count; i++)
+            radios[i]->tick(now);
+        dispatch();
+    }
+}
+
+void sim_set_loss(uint8_t percent) {
+    loss = percent;
+}
+
+void sim_set_noise(uint8_t channel, uint8_t percent) {
+    noise[channel & 0x7F] = percent;
+}
+
+void sim_set_spi_time(uint8_t us) {
+    spi_time = us;
+}
+
+void _delay_us(double us) {
+    sim_advance(us + 0.5);
+}
+
+void _delay_ms(double ms) {
+    sim_advance(ms * 1000 + 0.5);
+}
+
+// SPI backend
+// jobs run to completion right away, which is what the interrupt driven queue
+// looks like to a caller that waits for them
+static bool spi_fast = false;
+
+void spi_init(bool fast) {
+    spi_fast = fast;
+}
+
+void spi_queue(SPIJob& job) {
+    job.next = 0;
+    if(job.cs)
+        spi_select(*job.cs);
+    for(uint8_t i = 0; i < job.length; i++) {
+        const uint8_t data = spi_send(job.tx ? job.tx[i] : 0);
+        if(job.rx)
+            job.rx[i] = data;
+    }
+    if(job.cs)
+        spi_deselect(*job.cs);
+    job.done = true;
+    if(job.callback)
+        job.callback(job.context);
+}
+
+void spi_wait(SPIJob& job) {
+    (void)job;
+}
+
+void spi_transfer(const Pin& cs, const uint8_t* tx, uint8_t* rx, uint8_t length) {
+    SPIJob job = { &cs, tx, rx, length, 0, 0, false, 0 };
+    spi_queue(job);
+}
+
+uint8_t spi_send(uint8_t data) {
+    uint8_t result = 0xFF; // MISO floats high with no device selected
+    if(selected_count)
+        result = selected[selected_count - 1]->transfer(data);
+    sim_advance(spi_fast && spi_time > 1 ? spi_time / 2 : spi_time);
+    return result;
+}
+
+void spi_select(const Pin& cs) {
+    cs = 0;
+    sync_pins();
+    NRFSim* radio = find(cs);
+    if(radio && selected_count < 8) {
+        selected[selected_count++] = radio;
+        radio->select();
+    }
+}
+
+void spi_deselect(const Pin& cs) {
+    cs = 1;
+    sync_pins();
+    NRFSim* radio = find(cs);
+    if(!radio)
+        return;
+    for(uint8_t i = 0; i < selected_count; i++) {
+        if(selected[i] == radio) {
+            memmove(selected + i, selected + i + 1, (selected_count - i - 1) * sizeof(selected[0]));
+            selected_count--;
+            break;
+        }
+    }
+    radio->deselect();
+    dispatch();
+}
+
+// radio
+NRFSim::NRFSim(const Pin& cs, const Pin& ce, const Pin& irq):
+    spi_bytes(0), sent(0), received(0), air_time(0),
+    cs(cs), ce(ce), irq(irq), isr(0), irq_pending(false), irq_level(true),
+    rx_count(0), tx_count(0), command(0), index(0),
+    state(OFF), until(0), rx_since(0), tx_start(0), tx_end(0), pid(0), retries(0),
+    have_ack(false) {
+    // reset values
+    static const uint8_t reset[0x1E] = {
+        0x08, 0x3F, 0x03, 0x03, 0x03, 0x02, 0x0E, 0x0E, 0x00, 0x00,
+        0x00, 0x00, 0xC3, 0xC4, 0xC5, 0xC6, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    memcpy(reg, reset, sizeof(reg));
+    memset(address[0], 0xE7, 5);
+    memset(address[1], 0xC2, 5);
+    memset(address[2], 0xE7, 5);
+    memset(last_pid, 0xFF, sizeof(last_pid));
+    memset(last_sum, 0, sizeof(last_sum));
+    if(radio_count < 8)
+        radios[radio_count++] = this;
+    update_irq();
+}
+
+NRFSim::~NRFSim() {
+    for(uint8_t i = 0; i < radio_count; i++) {
+        if(radios[i] == this) {
+            memmove(radios + i, radios + i + 1, (radio_count - i - 1) * sizeof(radios[0]));
+            radio_count--;
+            break;
+        }
+    }
+}
+
+void NRFSim::attach_interrupt(SimISR isr) {
+    this->isr = isr;
+}
+
+void NRFSim::isr_call() {
+    if(isr)
+        isr();
+}
+
+bool NRFSim::owns(const Pin& pin) const {
+    return &pin.port == &cs.port && pin.pin == cs.pin;
+}
+
+bool NRFSim::take_interrupt() {
+    if(!irq_pending || !isr)
+        return false;
+    irq_pending = false;
+    return true;
+}
+
+uint8_t NRFSim::status() const {
+    return (reg[STATUS] & 0x70) | ((rx_count ? rx_fifo[0].pipe : 7) << RX_P_NO) |
+        (tx_count == 3 ? _BV(TX_FULL) : 0);
+}
+
+// IRQ is active low while an unmasked interrupt flag is set
+void NRFSim::update_irq() {
+    const bool level = !(reg[STATUS] & 0x70 & ~reg[CONFIG]);
+    if(irq_level && !level)
+        irq_pending = true;
+    irq_level = level;
+    if(level)
+        irq.pin_reg() |= _BV(irq.pin);
+    else
+        irq.pin_reg() &= ~_BV(irq.pin);
+}
+
+bool NRFSim::dynamic(uint8_t pipe) const {
+    return (reg[FEATURE] & _BV(EN_DPL)) && (reg[DYNPD] & _BV(pipe));
+}
+
+uint8_t NRFSim::address_width() const {
+    return (reg[SETUP_AW] & 0x03) ? (reg[SETUP_AW] & 0x03) + 2 : 5;
+}
+
+// preamble, address, 9-bit packet control field, payload and CRC
+uint32_t NRFSim::air_us(uint8_t length) const {
+    const uint32_t rate = reg[RF_SETUP] & 0x20 ? 250000 : reg[RF_SETUP] & _BV(RF_DR) ? 2000000 : 1000000;
+    const uint8_t crc = reg[CONFIG] & 0x08 ? (reg[CONFIG] & 0x04 ? 16 : 8) : 0;
+    const uint32_t bits = 8 * (1 + address_width() + length) + 9 + crc;
+    return (bits * 1000000 + rate - 1) / rate;
+}
+
+// pipe that receives packets sent to <tx_address>, -1 if none
+int NRFSim::match(const uint8_t* tx_address) const {
+    const uint8_t width = address_width();
+    for(uint8_t pipe = 0; pipe < 6; pipe++) {
+        if(!(reg[EN_RXADDR] & _BV(pipe)))
+            continue;
+        if(pipe < 2) {
+            if(!memcmp(address[pipe], tx_address, width))
+                return pipe;
+        }
+        else if(reg[RX_ADDR_P0 + pipe] == tx_address[0] &&
+                !memcmp(address[1] + 1, tx_address + 1, width - 1))
+            return pipe;
+    }
+    return -1;
+}
+
+int NRFSim::find_tx(bool ack_payload, uint8_t pipe) const {
+    for(uint8_t i = 0; i < tx_count; i++)
+        if(tx_fifo[i].ack_payload == ack_payload && (!ack_payload || tx_fifo[i].pipe == pipe))
+            return i;
+    return -1;
+}
+
+// PTX sends whatever is at the head of the TX FIFO, ACK payloads included (a PRX's
+// leftover ACK payload goes out as an ordinary packet)
+int NRFSim::tx_head() const {
+    return tx_count ? 0 : -1;
+}
+
+void NRFSim::pop_tx(int i) {
+    memmove(tx_fifo + i, tx_fifo + i + 1, (tx_count - i - 1) * sizeof(Payload));
+    tx_count--;
+}
+
+void NRFSim::select() {
+    index = 0;
+}
+
+uint8_t NRFSim::transfer(uint8_t data) {
+    spi_bytes++;
+    if(index == 0) {
+        const uint8_t result = status();
+        command = data;
+        index = 1;
+        if(command == 0xE1)      // FLUSH_TX
+            tx_count = 0;
+        else if(command == 0xE2) // FLUSH_RX
+            rx_count = 0;
+        return result;
+    }
+
+    const uint8_t i = index - 1;
+    uint8_t result = 0;
+    if(command < 0x20)                        // R_REGISTER
+        result = read_register(command, i);
+    else if(command == 0x60)                  // R_RX_PL_WID
+        result = rx_count ? rx_fifo[0].length : 0;
+    else if(command == 0x61)                  // R_RX_PAYLOAD
+        result = rx_count && i < rx_fifo[0].length ? rx_fifo[0].data[i] : 0;
+    else if(i < 32)                           // W_REGISTER and payload writes
+        buffer[i] = data;
+    if(index < 255)
+        index++;
+    return result;
+}
+
+void NRFSim::deselect() {
+    const uint8_t length = index > 1 ? (index - 1 > 32 ? 32 : index - 1) : 0;
+    if(length) {
+        if((command & 0xE0) == 0x20) {               // W_REGISTER
+            write_register(command & 0x1F, buffer, length);
+        }
+        else if(command == 0x61 && rx_count) {       // R_RX_PAYLOAD
+            memmove(rx_fifo, rx_fifo + 1, (rx_count - 1) * sizeof(Payload));
+            rx_count--;
+        }
+        else if(command == 0xA0 || command == 0xB0 || (command & 0xF8) == 0xA8) {
+            Payload payload;
+            memcpy(payload.data, buffer, length);
+            payload.length = length;
+            payload.pipe = command & 0x07;
+            payload.no_ack = command == 0xB0;
+            payload.ack_payload = (command & 0xF8) == 0xA8;
+            // NOACK and ACK payloads are only accepted with their FEATURE bits set
+            const bool accepted =
+                (!payload.no_ack || (reg[FEATURE] & _BV(EN_DYN_ACK))) &&
+                (!payload.ack_payload || (reg[FEATURE] & _BV(EN_ACK_PAY)));
+            if(accepted && tx_count < 3)
+                tx_fifo[tx_count++] = payload;
+        }
+    }
+    index = 0;
+    update_irq();
+}
+
+void NRFSim::write_register(uint8_t address, const uint8_t* data, uint8_t length) {
+    if(address == STATUS) {
+        reg[STATUS] &= ~(data[0] & 0x70); // write 1 to clear
+        return;
+    }
+    if(address == RX_ADDR_P0 || address == RX_ADDR_P1 || address == TX_ADDR) {
+        const uint8_t which = address == TX_ADDR ? 2 : address - RX_ADDR_P0;
+        memcpy(this->address[which], data, length > 5 ? 5 : length);
+        return;
+    }
+    if(address >= 0x1E || address == OBSERVE_TX || address == CD_REG || address == FIFO_STATUS ||
+            (address > FIFO_STATUS && address < DYNPD))
+        return; // read-only or reserved
+    reg[address] = data[0];
+    if(address == RF_CH)
+        reg[OBSERVE_TX] &= 0x0F; // PLOS_CNT resets on channel writes
+}
+
+uint8_t NRFSim::read_register(uint8_t address, uint8_t i) {
+    if(address == RX_ADDR_P0 || address == RX_ADDR_P1 || address == TX_ADDR) {
+        const uint8_t which = address == TX_ADDR ? 2 : address - RX_ADDR_P0;
+        return i < 5 ? this->address[which][i] : 0;
+    }
+    if(i)
+        return 0;
+    if(address == STATUS)
+        return status();
+    if(address == FIFO_STATUS)
+        return (tx_count == 3 ? 0x20 : 0) | (tx_count == 0 ? 0x10 : 0) |
+            (rx_count == 3 ? 0x02 : 0) | (rx_count == 0 ? 0x01 : 0);
+    if(address == CD_REG) {
+        // RPD: listening and something is on the air (emulated or noise)
+        if(state != RX)
+            return 0;
+        for(uint8_t r = 0; r < radio_count; r++)
+            if(radios[r] != this && radios[r]->state == TX_AIR && radios[r]->reg[RF_CH] == reg[RF_CH])
+                return 1;
+        return chance(noise[reg[RF_CH] & 0x7F]);
+    }
+    return address < 0x1E ? reg[address] : 0;
+}
+
+void NRFSim::tick(uint32_t now) {
+    const bool powered = reg[CONFIG] & _BV(PWR_UP),
+               enabled = ce.port & _BV(ce.pin),
+               prx = reg[CONFIG] & _BV(PRIM_RX);
+    if(!powered) {
+        state = OFF;
+        return;
+    }
+    switch(state) {
+        case OFF:
+            state = POWERING;
+            until = now + 1500;
+            break;
+        case POWERING:
+            if(now >= until)
+                state = STANDBY;
+            break;
+        case STANDBY:
+            if(!enabled)
+                break;
+            if(prx) {
+                state = RX_SETTLE;
+                until = now + 130;
+            }
+            else if(tx_head() >= 0 && !(reg[STATUS] & _BV(MAX_RT))) {
+                state = TX_SETTLE;
+                until = now + 130;
+            }
+            break;
+        case RX_SETTLE:
+        case RX:
+            if(!enabled || !prx)
+                state = STANDBY;
+            else if(state == RX_SETTLE && now >= until) {
+                state = RX;
+                rx_since = now;
+            }
+            break;
+        case TX_SETTLE:
+            if(prx)
+                state = STANDBY;
+            else if(now >= until) {
+                // new payload
+                pid++;
+                retries = 0;
+                reg[OBSERVE_TX] &= 0xF0;
+                start_tx(now);
+            }
+            break;
+        case TX_AIR:
+            if(now >= until)
+                end_tx(now);
+            break;
+        case TX_ACK:
+            if(now >= until) {
+                const int i = tx_head();
+                if(i >= 0)
+                    pop_tx(i);
+                reg[STATUS] |= _BV(TX_DS);
+                if(have_ack && rx_count < 3) {
+                    ack.pipe = 0;
+                    rx_fifo[rx_count++] = ack;
+                    reg[STATUS] |= _BV(RX_DR);
+                    received++;
+                }
+                state = STANDBY;
+                update_irq();
+            }
+            break;
+        case TX_RETRY:
+            if(now >= until)
+                start_tx(now);
+            break;
+    }
+}
+
+void NRFSim::start_tx(uint32_t now) {
+    const int i = tx_head();
+    if(i < 0) { // flushed
+        state = STANDBY;
+        return;
+    }
+    const uint32_t duration = air_us(tx_fifo[i].length);
+    tx_start = now;
+    tx_end = until = now + duration;
+    state = TX_AIR;
+    sent++;
+    air_time += duration;
+}
+
+void NRFSim::end_tx(uint32_t now) {
+    const int i = tx_head();
+    if(i < 0) {
+        state = STANDBY;
+        return;
+    }
+    const Payload packet = tx_fifo[i];
+    const bool no_ack = packet.no_ack || !(reg[EN_AA] & _BV(ENAA_P0));
+    have_ack = false;
+    const bool acked = deliver(packet, now, ack, have_ack);
+    if(no_ack) {
+        pop_tx(i);
+        reg[STATUS] |= _BV(TX_DS);
+        state = STANDBY;
+    }
+    else if(acked) {
+        // the ACK arrives after the receiver's turnaround
+        state = TX_ACK;
+        until = now + 130 + air_us(have_ack ? ack.length : 0);
+    }
+    else if(retries < (reg[SETUP_RETR] & 0x0F)) {
+        retries++;
+        reg[OBSERVE_TX] = (reg[OBSERVE_TX] & 0xF0) | retries;
+        state = TX_RETRY;
+        until = now + 250 * ((reg[SETUP_RETR] >> ARD) + 1);
+    }
+    else {
+        if((reg[OBSERVE_TX] >> PLOS_CNT) < 15)
+            reg[OBSERVE_TX] += 1 << PLOS_CNT;
+        reg[STATUS] |= _BV(MAX_RT);
+        state = STANDBY;
+    }
+    update_irq();
+}
+
+// put <packet> on the air, returns true if it was acknowledged
+bool NRFSim::deliver(const Payload& packet, uint32_t now, Payload& ack_out, bool& ack_out_valid) {
+    const uint8_t channel = reg[RF_CH];
+    for(uint8_t r = 0; r < radio_count; r++) {
+        const NRFSim* other = radios[r];
+        if(other != this && other->sent && other->reg[RF_CH] == channel &&
+                other->tx_start < tx_end && other->tx_end > tx_start)
+            return false; // collision
+    }
+    if(chance(loss))
+        return false;
+
+    uint16_t sum = packet.length;
+    for(uint8_t i = 0; i < packet.length; i++)
+        sum = sum * 31 + packet.data[i];
+    const bool dpl = dynamic(0);
+
+    uint8_t ackers = 0;
+    for(uint8_t r = 0; r < radio_count; r++) {
+        NRFSim* receiver = radios[r];
+        if(receiver == this || receiver->state != RX || receiver->rx_since > tx_start ||
+                receiver->reg[RF_CH] != channel ||
+                (receiver->reg[RF_SETUP] & 0x28) != (reg[RF_SETUP] & 0x28) ||
+                receiver->address_width() != address_width())
+            continue;
+        const int pipe = receiver->match(address[2]);
+        if(pipe < 0)
+            continue;
+        // the payload format has to match (a wrong width fails the CRC)
+        if(receiver->dynamic(pipe) != dpl ||
+                (!dpl && packet.length != receiver->reg[RX_PW_P0 + pipe]))
+            continue;
+
+        const bool auto_ack = (receiver->reg[EN_AA] & _BV(pipe)) && !packet.no_ack;
+        const bool duplicate = auto_ack && receiver->last_pid[pipe] == pid &&
+            receiver->last_sum[pipe] == sum;
+        if(!duplicate) {
+            if(receiver->rx_count == 3)
+                continue; // RX FIFO full: not stored and not acknowledged
+            Payload& stored = receiver->rx_fifo[receiver->rx_count++];
+            stored = packet;
+            stored.pipe = pipe;
+            receiver->reg[STATUS] |= _BV(RX_DR);
+            receiver->received++;
+            receiver->last_pid[pipe] = pid;
+            receiver->last_sum[pipe] = sum;
+        }
+        if(auto_ack) {
+            ackers++;
+            const int i = receiver->find_tx(true, pipe);
+            if(i >= 0) {
+                ack_out = receiver->tx_fifo[i];
+                ack_out_valid = true;
+                receiver->pop_tx(i);
+            }
+        }
+        receiver->update_irq();
+    }
+    // several receivers acknowledging at once collide, and ACKs get lost too
+    return ackers == 1 && !chance(loss);
+}
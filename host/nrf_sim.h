@@ -0,0 +1,121 @@
+//////////////////////////////
+// nrf_sim.h
+//
+// register-level nRF24L01+ emulator for host builds of nrf.h
+// Copyright Aaron Schraner, 2018
+//
+// each NRFSim is attached to the CE, CS and IRQ pins of one NRF object and
+// implements the SPI command set behind spi_select()/spi_send()/spi_deselect():
+// registers, 3-level RX and TX FIFOs, STATUS and the IRQ pin, dynamic payload
+// widths, ACK payloads, NOACK payloads, auto-ack with ARD/ARC retransmission and
+// RPD (carrier detect). all radios share one simulated medium, so any number of
+// them can talk to each other in one process.
+//
+// time only passes in _delay_us()/_delay_ms(), per SPI byte and in sim_advance().
+// settling, power up and air time follow the datasheet, ACKs arrive 130us plus
+// their air time after a packet. radios on the same channel whose transmissions
+// overlap both lose their packets. pipe addresses, data rate and payload format
+// (fixed or dynamic width) must match for a packet to arrive, like on the real radio.
+//
+
+#ifndef NRF_SIM_H
+#define NRF_SIM_H
+#include <stdint.h>
+#include <avr/io.h>
+#include "../pin.h"
+
+typedef void (*SimISR)();
+
+class NRFSim {
+    public:
+        NRFSim(const Pin& cs, const Pin& ce, const Pin& irq);
+        ~NRFSim();
+
+        // run <isr> on falling edges of the IRQ pin while interrupts are enabled
+        void attach_interrupt(SimISR isr);
+
+        // counters
+        uint32_t spi_bytes;   // bytes on the SPI bus
+        uint32_t sent;        // packets put on the air (including retransmissions)
+        uint32_t received;    // payloads stored in the RX FIFO
+        uint32_t air_time;    // us spent transmitting
+
+        // internal (used by nrf_sim.cpp)
+        struct Payload {
+            uint8_t data[32];
+            uint8_t length;
+            uint8_t pipe;     // RX: pipe it arrived on, TX: ACK payload pipe
+            bool no_ack;
+            bool ack_payload; // W_ACK_PAYLOAD entry (PRX)
+        };
+        enum State: uint8_t {
+            OFF, POWERING, STANDBY, RX_SETTLE, RX, TX_SETTLE, TX_AIR, TX_ACK, TX_RETRY
+        };
+
+        void select();
+        void deselect();
+        uint8_t transfer(uint8_t data);
+        void tick(uint32_t now);
+        bool owns(const Pin& pin) const;
+        bool take_interrupt();
+        void isr_call();
+
+    private:
+        Pin cs, ce, irq;
+        SimISR isr;
+        bool irq_pending, irq_level;
+
+        uint8_t reg[0x1E];
+        uint8_t address[3][5]; // RX_ADDR_P0, RX_ADDR_P1, TX_ADDR
+
+        Payload rx_fifo[3], tx_fifo[3];
+        uint8_t rx_count, tx_count;
+
+        // current SPI command
+        uint8_t command, index;
+        uint8_t buffer[32];
+
+        // radio state
+        State state;
+        uint32_t until;      // end of the current timed state
+        uint32_t rx_since;   // listening since
+        uint32_t tx_start, tx_end;
+        uint8_t pid;         // packet id of the payload being sent
+        uint8_t retries;
+        Payload ack;         // ACK payload received with the last ACK
+        bool have_ack;
+        uint8_t last_pid[6];  // duplicate detection per pipe
+        uint16_t last_sum[6];
+
+        uint8_t status() const;
+        void update_irq();
+        bool dynamic(uint8_t pipe) const;
+        uint8_t address_width() const;
+        uint32_t air_us(uint8_t length) const;
+        int match(const uint8_t* tx_address) const;
+        int find_tx(bool ack_payload, uint8_t pipe) const;
+        int tx_head() const;
+        void pop_tx(int i);
+        void write_register(uint8_t address, const uint8_t* data, uint8_t length);
+        uint8_t read_register(uint8_t address, uint8_t index);
+        void start_tx(uint32_t now);
+        void end_tx(uint32_t now);
+        bool deliver(const Payload& packet, uint32_t now, Payload& ack_out, bool& ack_out_valid);
+};
+
+// simulated microseconds since start
+uint32_t sim_micros();
+
+// let <us> of simulated time pass
+void sim_advance(uint32_t us);
+
+// percentage of packets (and ACKs) lost on the air
+void sim_set_loss(uint8_t percent);
+
+// chance (percent) that RPD reads as set on <channel> without any emulated transmitter
+void sim_set_noise(uint8_t channel, uint8_t percent);
+
+// simulated time per SPI byte (default 2us, SCK = 4MHz, halved after spi_init(true))
+void sim_set_spi_time(uint8_t us);
+
+#endif
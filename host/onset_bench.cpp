@@ -0,0 +1,244 @@
+//////////////////////////////
+// onset_bench.cpp
+//
+// runs the onset detector (onset.h) on a click track the way the analyzer sees it:
+// 8-bit samples at 44100/16 Hz, a 128-point FFT of the latest samples every frame
+// and the same magnitudes as main.cpp's analyze(). compares the onsets against the
+// labeled click times and reports accuracy and detection latency, then how well the
+// tempo tracker (tempo.h) follows the clicks' tempo and phase.
+// exits with 1 if recall or precision is below 90%.
+// Copyright Aaron Schraner, 2018
+//
+// usage: ./onset_bench [track.wav labels.txt] [-f frame_ms] [-s sensitivity] [-r refractory]
+//                      [-t bpm]
+//   without a WAV file a synthetic click track (kicks over noise and a changing
+//   bass line, at -t BPM) is generated. -f 50 runs at multi-resolution mode's
+//   rate of short frames. labels are one click time in seconds per line, extra
+//   columns are ignored (Audacity label exports work as they are).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "../fix_fft.h"
+#include "../onset.h"
+#include "../tempo.h"
+#include "../settings.h"
+
+const int fft_length = 128;
+const double rate = 44100.0 / downsample; // analyzer sample rate
+
+// 16-bit PCM WAV, channels mixed, resampled to <rate>
+static bool read_wav(const char* path, std::vector<int16_t>& samples) {
+    FILE* f = fopen(path, "rb");
+    if(!f) {
+        perror(path);
+        return false;
+    }
+    char id[4];
+    uint32_t size;
+    if(fread(id, 1, 4, f) != 4 || memcmp(id, "RIFF", 4) || fread(&size, 4, 1, f) != 1 ||
+            fread(id, 1, 4, f) != 4 || memcmp(id, "WAVE", 4)) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        fclose(f);
+        return false;
+    }
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t file_rate = 0;
+    std::vector<int16_t> data;
+    while(fread(id, 1, 4, f) == 4 && fread(&size, 4, 1, f) == 1) {
+        if(!memcmp(id, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if(size < 16 || fread(fmt, 1, 16, f) != 16)
+                break;
+            memcpy(&format, fmt, 2);
+            memcpy(&channels, fmt + 2, 2);
+            memcpy(&file_rate, fmt + 4, 4);
+            memcpy(&bits, fmt + 14, 2);
+            fseek(f, size - 16 + (size & 1), SEEK_CUR);
+        }
+        else if(!memcmp(id, "data", 4)) {
+            data.resize(size / 2);
+            data.resize(fread(data.data(), 2, data.size(), f));
+            break;
+        }
+        else
+            fseek(f, size + (size & 1), SEEK_CUR);
+    }
+    fclose(f);
+    if(format != 1 || bits != 16 || !channels || !file_rate) {
+        fprintf(stderr, "%s: only 16-bit PCM is supported\n", path);
+        return false;
+    }
+    const size_t frames = data.size() / channels;
+    for(double t = 0; ; t += file_rate / rate) {
+        const size_t i = t;
+        if(i >= frames)
+            break;
+        int32_t sum = 0;
+        for(uint16_t c = 0; c < channels; c++)
+            sum += data[i * channels + c];
+        samples.push_back(sum / channels);
+    }
+    return true;
+}
+
+static bool read_labels(const char* path, std::vector<double>& labels) {
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), f)) {
+        char* end;
+        const double t = strtod(line, &end);
+        if(end != line)
+            labels.push_back(t);
+    }
+    fclose(f);
+    return true;
+}
+
+// kicks at <tempo> +-6 BPM over noise and a bass line that changes note every 0.7s
+static void synthesize(std::vector<int16_t>& samples, std::vector<double>& labels, double tempo) {
+    const double length = 30.0;
+    srand(1);
+    double next_click = 0.5, bpm = 120;
+    double click_age = 1;
+    double phase = 0;
+    for(int i = 0; i < length * rate; i++) {
+        const double t = i / rate;
+        if(t >= next_click) {
+            labels.push_back(next_click);
+            click_age = 0;
+            bpm = tempo + 6 * sin(next_click / 8); // slowly drifting tempo
+            next_click += 60 / bpm;
+        }
+        const double note = 55 * pow(2, ((int)(t / 0.7) * 5 % 12) / 12.0);
+        phase += 2 * M_PI * note / rate;
+        double value = 0.15 * sin(phase) + 0.04 * (rand() / (double)RAND_MAX - 0.5);
+        if(click_age < 0.15) // kick: decaying 120-60Hz thump plus a broadband tick
+            value += exp(-click_age * 25) * 0.6 * sin(2 * M_PI * (120 - 200 * click_age) * click_age) +
+                    (click_age < 0.005 ? 0.4 * (rand() / (double)RAND_MAX - 0.5) : 0);
+        click_age += 1 / rate;
+        value = value > 1 ? 1 : value < -1 ? -1 : value;
+        samples.push_back(value * 32767);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* wav = 0;
+    const char* label_path = 0;
+    double frame_ms = 25;
+    double click_tempo = 124;
+    Settings settings = default_settings;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-f") && i + 1 < argc)
+            frame_ms = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            click_tempo = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            settings.onset_sensitivity = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+            settings.refractory = atoi(argv[++i]);
+        else if(!wav)
+            wav = argv[i];
+        else
+            label_path = argv[i];
+    }
+
+    std::vector<int16_t> samples;
+    std::vector<double> labels;
+    if(wav) {
+        if(!label_path) {
+            fprintf(stderr, "usage: %s [track.wav labels.txt] [-f frame_ms] [-s sensitivity] [-r refractory] [-t bpm]\n", argv[0]);
+            return 2;
+        }
+        if(!read_wav(wav, samples) || !read_labels(label_path, labels))
+            return 2;
+        printf("%s: %.1fs, %u labels\n", wav, samples.size() / rate, (unsigned)labels.size());
+    }
+    else {
+        synthesize(samples, labels, click_tempo);
+        printf("synthetic click track: %.1fs, %u clicks\n", samples.size() / rate, (unsigned)labels.size());
+    }
+
+    // frames at <frame_ms> intervals, each on the latest fft_length samples
+    OnsetDetector onsets;
+    TempoTracker tempo;
+    std::vector<double> detections;
+    uint32_t tempo_frames = 0, tempo_close = 0, phase_count = 0, phase_error = 0;
+    size_t next_label = 0;
+    const int frame_samples = frame_ms / 1000 * rate;
+    // refrac counts 25ms frames, as in main.cpp's analyze()
+    const uint8_t refractory = settings.refractory * 25 / frame_ms + 0.5;
+    for(size_t end = fft_length; end <= samples.size(); end += frame_samples) {
+        char re[fft_length], im[fft_length];
+        for(int i = 0; i < fft_length; i++) {
+            re[i] = samples[end - fft_length + i] >> 8; // ADC >> 2, read as signed
+            im[i] = 0;
+        }
+        fix_fft(re, im, 7, 0);
+        uint8_t bins[fft_length / 2];
+        for(int i = 0; i < fft_length / 2; i++)
+            bins[i] = abs(re[i]) / 2 + abs(im[i]) / 2;
+        const bool onset = onsets.update(bins, fft_length / 2, settings.onset_sensitivity, refractory);
+        if(onset)
+            detections.push_back(end / rate);
+        tempo.update(onsets.last_flux(), onset, end / rate * 1000);
+
+        // beat clock phase at the clicks of the last frame (0: on the beat)
+        for(; next_label < labels.size() && labels[next_label] <= end / rate; next_label++) {
+            if(end <= samples.size() / 2 || !tempo.bpm())
+                continue;
+            const int phase = tempo.phase(labels[next_label] * 1000);
+            phase_error += phase < 128 ? phase : 256 - phase;
+            phase_count++;
+        }
+
+        // the labels' tempo around this frame, compared in the second half of the track
+        if(end > samples.size() / 2 && labels.size() > 1) {
+            size_t l = 1;
+            while(l + 1 < labels.size() && labels[l] < end / rate)
+                l++;
+            const double bpm = 60 / (labels[l] - labels[l - 1]);
+            tempo_frames++;
+            if(fabs(tempo.bpm() - bpm) <= bpm * 0.05)
+                tempo_close++;
+        }
+    }
+
+    // a detection up to 100ms after a label is a hit (the first one per label)
+    const double window = 0.1;
+    size_t hits = 0, d = 0;
+    double latency_total = 0, latency_max = 0;
+    for(size_t l = 0; l < labels.size(); l++) {
+        while(d < detections.size() && detections[d] < labels[l])
+            d++;
+        if(d < detections.size() && detections[d] - labels[l] <= window &&
+                (l + 1 == labels.size() || detections[d] < labels[l + 1])) {
+            const double latency = detections[d] - labels[l];
+            latency_total += latency;
+            latency_max = latency > latency_max ? latency : latency_max;
+            hits++;
+        }
+    }
+    const double recall = labels.empty() ? 0 : (double)hits / labels.size(),
+                 precision = detections.empty() ? 0 : (double)hits / detections.size();
+    printf("  frame %.0fms, sensitivity %u/16, refractory %u frames (%ums)\n",
+            frame_ms, settings.onset_sensitivity, refractory, (unsigned)(refractory * frame_ms));
+    printf("  %u detections, %u hits: recall %.1f%%, precision %.1f%%\n",
+            (unsigned)detections.size(), (unsigned)hits, recall * 100, precision * 100);
+    printf("  latency: mean %.1fms, max %.1fms (includes up to one frame of waiting)\n",
+            hits ? latency_total / hits * 1000 : 0.0, latency_max * 1000);
+    printf("  tempo: %u BPM at the end (confidence %u), within 5%% of the clicks in %.1f%% of the second half\n",
+            tempo.bpm(), tempo.confidence(), tempo_frames ? 100.0 * tempo_close / tempo_frames : 0.0);
+    printf("  beat clock: mean phase error at the clicks %.1f%% of a beat\n",
+            phase_count ? 100.0 * phase_error / phase_count / 256 : 0.0);
+    const bool ok = recall >= 0.9 && precision >= 0.9;
+    puts(ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
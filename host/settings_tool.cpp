@@ -0,0 +1,109 @@
+//////////////////////////////
+// settings_tool.cpp
+//
+// inspect and edit settings in an EEPROM image using the firmware's SettingsStore
+// usage: settings_tool <image> [name=value ...]
+//   without assignments, lists the ring slots and the settings that would be loaded
+//   with assignments, stores the new settings the way the firmware would and
+//   writes the image back
+// Copyright Aaron Schraner, 2018
+// 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../settings_store.h"
+#include "eeprom_sim.h"
+
+static void print_slots() {
+    for(uint8_t s=0; s<SETTINGS_SLOTS; s++) {
+        const uint16_t address = SETTINGS_BASE + s * SETTINGS_SLOT_SIZE;
+        SettingsHeader header;
+        for(uint8_t i=0; i<sizeof(header); i++)
+            reinterpret_cast<uint8_t*>(&header)[i] = ee_read(address + i);
+        if(header.magic != SETTINGS_MAGIC) {
+            printf("slot %2u: empty\n", s);
+            continue;
+        }
+        uint32_t max_writes = 0;
+        for(uint8_t i=0; i<SETTINGS_SLOT_SIZE; i++)
+            if(eeprom_sim_writes(address + i) > max_writes)
+                max_writes = eeprom_sim_writes(address + i);
+        printf("slot %2u: version %u, sequence %5u, %u bytes", 
+                s, header.version, header.sequence, header.length);
+        if(max_writes)
+            printf(", written %u times", (unsigned)max_writes);
+        printf("\n");
+    }
+}
+
+static void print_settings(const Settings& settings) {
+    for(uint8_t id=0; id<PARAM_COUNT; id++)
+        printf("%s=%u\n", parameters[id].name, get_parameter(settings, id));
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <image> [name=value ...]\n", argv[0]);
+        return 1;
+    }
+    const char* image = argv[1];
+    if(!eeprom_sim_load(image))
+        printf("%s: not found, starting from an erased EEPROM\n", image);
+
+    Settings settings = default_settings;
+    SettingsStore store;
+    if(!store.load(settings))
+        printf("no valid settings record, using defaults\n");
+
+    if(argc == 2) {
+        print_slots();
+        print_settings(settings);
+        return 0;
+    }
+
+    uint16_t now = 0;
+    for(int i=2; i<argc; i++) {
+        char name[16];
+        const char* value = strchr(argv[i], '=');
+        if(!value || value - argv[i] >= (int)sizeof(name)) {
+            fprintf(stderr, "%s: expected name=value\n", argv[i]);
+            return 1;
+        }
+        memcpy(name, argv[i], value - argv[i]);
+        name[value - argv[i]] = 0;
+
+        uint8_t id = 0;
+        while(id < PARAM_COUNT && strcmp(name, parameters[id].name))
+            id++;
+        if(id == PARAM_COUNT) {
+            fprintf(stderr, "%s: unknown parameter\n", name);
+            return 1;
+        }
+        set_parameter(settings, id, atol(value + 1));
+        store.changed(now);
+    }
+
+    // run the store the way the main loop would, one poll per 1ms
+    int polls = 0;
+    while(store.busy()) {
+        store.poll(settings, now++);
+        eeprom_sim_advance(1000);
+        polls++;
+    }
+    printf("stored after %d ms\n", polls);
+
+    if(!eeprom_sim_save(image)) {
+        perror(image);
+        return 1;
+    }
+
+    // read back through a fresh store, as the firmware does at boot
+    Settings loaded = default_settings;
+    SettingsStore check;
+    check.load(loaded);
+    print_slots();
+    print_settings(loaded);
+    return memcmp(&loaded, &settings, sizeof(settings)) ? 1 : 0;
+}
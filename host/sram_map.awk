@@ -0,0 +1,51 @@
+#!/usr/bin/awk -f
+##############################
+# sram_map.awk
+#
+# static SRAM usage per global and per module (object file) from an avr-ld map
+# file. needs -fdata-sections so every global has its own input section.
+# Copyright Aaron Schraner, 2018
+#
+# usage: awk -f host/sram_map.awk emre.map | sort -rn
+#
+
+function hex(s,    i, c, v) {
+    v = 0
+    s = tolower(s)
+    sub(/^0x/, "", s)
+    for(i = 1; i <= length(s); i++) {
+        c = index("0123456789abcdef", substr(s, i, 1)) - 1
+        v = v * 16 + c
+    }
+    return v
+}
+
+# input sections of .data, .bss and .noinit, the address, size and object may be
+# on the next line when the section name is long
+/^ \.(data|bss|noinit)/ {
+    name = $1
+    if(NF == 1) {
+        if(getline <= 0)
+            next
+        address = $1; size = $2; object = $3
+    }
+    else {
+        address = $2; size = $3; object = $4
+    }
+    # SRAM is at 0x800000 and up in the AVR address space
+    if(hex(address) < 8388608 || hex(size) == 0)
+        next
+    sub(/^\.(data|bss|noinit)\.?/, "", name)
+    n = split(object, path, "/")
+    module = path[n]
+    bytes = hex(size)
+    printf("%5d  %-32s %s\n", bytes, name == "" ? "(unnamed)" : name, module)
+    per_module[module] += bytes
+    total += bytes
+}
+
+END {
+    for(module in per_module)
+        printf("%5d  %-32s %s\n", per_module[module], "[module total]", module)
+    printf("%5d  %-32s of 8192 bytes, %d left for heap and stack\n", total, "[static SRAM]", 8192 - total)
+}
@@ -0,0 +1,118 @@
+//////////////////////////////
+// strip_bench.cpp
+//
+// checks the bit-plane transpose of the parallel strip driver (parallel_strip.h)
+// against a bit by bit reference for every strip count, then times parallel draws
+// against chaining the strips (led_strip.h) on the host's port registers.
+// exits with 1 if any of the checks fail.
+// Copyright Aaron Schraner, 2018
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <avr/io.h>
+#include "../parallel_strip.h"
+#include "../led_strip.h"
+#include "check.h"
+
+// random bytes of 1 to 8 strips against the definition of the planes
+void bench_transpose() {
+    puts("transpose");
+    srand(1);
+    bool ok = true;
+    for(int round = 0; round < 10000; round++) {
+        const uint8_t count = 1 + round % 8;
+        uint8_t bytes[8], planes[8];
+        for(uint8_t s = 0; s < count; s++)
+            bytes[s] = rand();
+        transpose_planes(bytes, count, planes);
+        for(uint8_t b = 0; b < 8; b++)
+            for(uint8_t s = 0; s < 8; s++) {
+                const bool expected = s < count && (bytes[s] >> (7 - b) & 1);
+                if(((planes[b] >> s) & 1) != expected)
+                    ok = false;
+            }
+    }
+    check(ok, "bit s of plane b is bit 7-b of strip s");
+}
+
+// the planes of random words of STRIPS strips carry every strip's word, MSB first
+template <uint8_t STRIPS>
+bool check_encode() {
+    for(int round = 0; round < 2000; round++) {
+        uint32_t words[STRIPS];
+        for(uint8_t s = 0; s < STRIPS; s++)
+            words[s] = (uint32_t)rand() << 16 ^ rand();
+        uint8_t planes[32];
+        ParallelStrip<STRIPS>::encode(words, planes);
+        for(uint8_t s = 0; s < STRIPS; s++) {
+            uint32_t word = 0;
+            for(uint8_t b = 0; b < 32; b++)
+                word = word << 1 | ((planes[b] >> s) & 1);
+            if(word != words[s])
+                return false;
+        }
+        for(uint8_t b = 0; b < 32; b++)
+            if(planes[b] >> STRIPS)
+                return false; // bits above the data lines
+    }
+    return true;
+}
+
+void bench_encode() {
+    puts("encode");
+    check(check_encode<1>() && check_encode<2>() && check_encode<3>() && check_encode<4>() &&
+            check_encode<5>() && check_encode<6>() && check_encode<7>(),
+            "1-7 strips: the planes carry every word");
+}
+
+// LEDs per strip, like main.cpp's strip_length
+const uint16_t leds = 58;
+
+// host ns per draw() of <strip> (port writes to plain memory, see avr/io.h)
+template <typename Strip, size_t N>
+double draw_ns(Strip& strip, const Color (&pixels)[N]) {
+    const int draws = 200;
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int d = 0; d < draws; d++)
+        strip.draw(pixels);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / draws;
+}
+
+// <STRIPS> strips of <leds> drawn in parallel and chained into one, returns the ratio
+template <uint8_t STRIPS>
+double bench_draw() {
+    static Color pixels[STRIPS * leds];
+    for(uint16_t i = 0; i < STRIPS * leds; i++)
+        pixels[i] = Color(rand() & 0xFF, rand() & 0xFF, rand() & 0xFF);
+    ParallelStrip<STRIPS> parallel(PORTA);
+    LEDStrip chained(Pin(PORTB, 1), Pin(PORTB, 2), STRIPS * leds);
+    const double parallel_ns = draw_ns(parallel, pixels), chained_ns = draw_ns(chained, pixels);
+    printf("  %u strips: parallel %6.1fus, chained %6.1fus (%.1fx)\n",
+            STRIPS, parallel_ns / 1000, chained_ns / 1000, chained_ns / parallel_ns);
+    return chained_ns / parallel_ns;
+}
+
+// the whole draw() including the transpose, against the host's port registers. host
+// times only compare the two, the AVR spends its time differently
+void bench_draws() {
+    printf("draw %u LEDs per strip (host time)\n", leds);
+    bench_draw<1>();
+    bench_draw<2>();
+    bench_draw<3>();
+    bench_draw<4>();
+    bench_draw<5>();
+    bench_draw<6>();
+    const double ratio = bench_draw<7>();
+    check(ratio > 2, "7 parallel strips draw faster than chained");
+}
+
+int main() {
+    bench_transpose();
+    bench_encode();
+    bench_draws();
+    return check_summary();
+}
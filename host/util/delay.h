@@ -0,0 +1,13 @@
+//////////////////////////////
+// util/delay.h (host)
+//
+// delays advance the simulated time (host/nrf_sim.cpp)
+// Copyright Aaron Schraner, 2018
+// 
+#ifndef HOST_DELAY_H
+#define HOST_DELAY_H
+
+void _delay_us(double us);
+void _delay_ms(double ms);
+
+#endif
@@ -66,7 +66,7 @@ class LEDStrip {
       send32(0UL); // send 32 zeros for start frame
     }
     inline void send_end_frame() const {
-      send32(~0UL); // send 32 ones for end frame
+      send32(0xFFFFFFFFUL); // send 32 ones for end frame
     }
     // TODO: hardware SPI??
     void send32(uint32_t value) const {
@@ -6,21 +6,62 @@
 #include "circular_buffer.h"
 #include "timer.h"
 #include "led_strip.h"
+#include "parallel_strip.h"
+#include "sram.h"
 #include "usart.h"
 #include "fix_fft.h"
 #include "volume.h"
 #include "nrf.h"
+#include "stream.h"
+#include "settings.h"
+#include "command.h"
+#include "settings_store.h"
+#include "remote_protocol.h"
+#include "base_link.h"
+#include "broadcast.h"
+#include "channel_survey.h"
+#include "acceleration.h"
+#include "onset.h"
+#include "tempo.h"
+#include "envelope.h"
+#include "stereo.h"
+#include "resolution.h"
+#include "render.h"
+#include "effects.h"
 
 
 const int strip_length = 58; // number of LEDs on strip
 const int fft_length = 128;  // number of samples for FFT
 
 // USART for debugging (accessible over USB on arduino mega)
+#ifdef SPECTRUM_STREAM
+// binary stream of samples, bins and colors every frame (decode with host/capture)
+USART<0, 32, 512> usart(1000000);
+#else
 USART<0> usart(38400);
+#endif
+SpectrumStream<decltype(usart)> stream(usart);
+
+// runtime-tunable settings (see settings.h), persisted in EEPROM
+Settings settings = default_settings;
+SettingsStore settings_store;
+
+// apply a changed setting to the hardware
+void apply_setting(uint8_t id);
+
+// command parsers for USART and nRF input (separate so their bytes can't interleave)
+CommandParser<decltype(usart)> usart_commands(usart, settings, apply_setting),
+                               radio_commands(usart, settings, apply_setting);
 
 // sample buffer for FFT
 // populated with ADC samples by timer interrupt
 CircularBuffer<uint8_t, fft_length> circular_buffer;
+// right channel samples (stereo layouts, circular_buffer holds the left channel),
+// the 128 samples before circular_buffer's in the 256-point mode
+CircularBuffer<uint8_t, fft_length> right_buffer;
+// samples decimated by 2 for the multi-resolution analyzer's long FFT
+CircularBuffer<uint8_t, fft_length> bass_buffer;
+Decimator decimator;
 
 // array of color objects representing LED strip
 Color strip[strip_length];
@@ -56,124 +97,676 @@ Pin nrf_irq(PORTL, 0, INPUT), // arduino mega pin 49
 // nRF24L01+ radio object
 NRF nrf(nrf_irq, nrf_ce, nrf_cs);
 
-// pin 13 on Arduino MEGA (has an LED on it)
-Pin LED_pin(PORTB, 7, OUTPUT);
-
-// clock and data pins for LED strip
-Pin led_clk(PORTA, 0, OUTPUT);  // pin 22
-Pin led_data(PORTA, 1, OUTPUT); // pin 23
+bool movable_feedback = false; // show the result of a '?' check once it is done
+Acceleration key_accel; // velocity-sensitive volume steps for '+' and '-'
 
-LEDStrip led_strip(led_clk, led_data, strip_length);
+// background channel survey, for moving to a quieter channel when the remote asks
+ChannelSurvey survey;
 
-// real and imaginary buffers for FFT
-char fft_buffer[fft_length];
-char fft_ibuffer[fft_length];
+// pin 13 on Arduino MEGA (has an LED on it)
+Pin LED_pin(PORTB, 7, OUTPUT);
 
-// used by weighted-moving-average calculation
-uint16_t strip_buffer[58];
+// LED strips: clock on PA0 (pin 22), data on PA1 (pin 23) and up, the strip is split
+// into strip_count segments that are drawn in parallel (parallel_strip.h). the
+// encoder's pins are reserved, which leaves room for 2 strips on PORTA
+const uint8_t strip_count = 1;
+ParallelStrip<strip_count, _BV(3) | _BV(5) | _BV(7)> led_strip(PORTA);
+
+// real and imaginary buffers for FFT, halves of one work buffer that the 256-point
+// real FFT uses as a whole (and leaves its magnitudes in)
+char fft_work[fft_length * 2];
+char* const fft_buffer = fft_work;
+char* const fft_ibuffer = fft_work + fft_length;
+
+// FFT magnitudes (first half of the spectrum, mid spectrum in the stereo layouts)
+uint8_t fft_bins[fft_length / 2];
+// per-LED magnitudes of the stereo layouts (stereo.h)
+uint8_t led_bins[strip_length];
+// long (bass) and short (treble) FFTs on alternate frames (resolution.h)
+MultiResolution<strip_length> multires;
+
+// analysis cost of the last frame, reported by the 'p' key
+uint16_t analysis_us = 0, fft_us = 0;
+// worst analysis and FFT cost of each layout (StereoLayout), measured at boot
+uint16_t layout_analysis_us[LAYOUT_MID_SIDE + 1], layout_fft_us[LAYOUT_MID_SIDE + 1];
+
+// per-bin noise floor, attack/release and peak hold (replaces the WMA)
+SpectrumEnvelope<strip_length> envelope;
+
+// per-LED intensity, made by the effect or received from a master (broadcast.h)
+uint8_t intensities[strip_length];
+// per-LED spectrum intensity (envelope.h), the input of the effects
+uint8_t spectrum[strip_length];
+
+// warn when less SRAM than this was left between the heap and the deepest stack
+const uint16_t sram_warning = 512;
+bool sram_low = false;
+
+// visualizer effects (effects.h) and the worst cost of each seen so far
+EffectEngine effect;
+uint16_t effect_us[EFFECT_COUNT];
+const uint16_t effect_budget_us = 1000; // well inside the 20ms wait of each frame
+
+// strip refreshes between frames (render.h), key feedback holds the strip for a moment
+Renderer<strip_length> renderer;
+const uint8_t feedback_ms = 50;
+uint16_t render_us = 0; // cost of the last refresh, reported by the 'p' key
+
+// beat effects (onset.h)
+OnsetDetector onsets;
+TempoTracker tempo;  // BPM and beat clock
+uint8_t flash = 0;   // added to every intensity, decays each frame
+uint8_t palette = 0; // color palette, advanced on onsets
+
+// broadcast state
+uint8_t broadcast_seq = 0;        // last sent (master) or received (slave) frame
+uint8_t broadcast_values[strip_length]; // last received frame
+bool broadcast_new = false;       // broadcast_values not rendered yet
+uint8_t broadcast_gap = 0;        // seq difference to the frame before it
+uint8_t broadcast_age = 0;        // frames rendered since the last received one
+uint16_t broadcast_dropped = 0;   // frames the master couldn't send (radio busy)
+
+// static SRAM budget (ATmega2560: 8192 bytes), the largest users with avr-gcc sizes:
+//   usart             275  two 128 byte rings (SPECTRUM_STREAM: 32 + 512, 563)
+//   nrf               210  3 packet RX queue, TX payload buffer, register shadows
+//   sample rings      402  circular_buffer, right_buffer, bass_buffer
+//   fft_work          256  both 128-point halves, or the whole 256-point real FFT
+//   fft_bins, led_bins 122
+//   envelope          348  noise floor, level, peak and hold per LED
+//   tempo, onsets     368  onset envelope, lag scores, previous bins
+//   strip, intensities, spectrum, broadcast_values 348
+//   effect             69  state of the selected effect
+//   survey, settings, settings_store, multires ~260
+// about 2.7KB in all. the 256-point mode adds nothing: its window is circular_buffer
+// plus right_buffer (unused in mono) and its spectrum stays in fft_work. that leaves
+// over 5KB for the stack (analyze() -> fix_fft() plus an ISR needs a few hundred
+// bytes, 'm' reports the stack's high-water mark) and vector.h's heap.
+// `make sram` lists all globals per module from the linker map.
+static_assert(sizeof(usart) + sizeof(nrf) + sizeof(circular_buffer) + sizeof(right_buffer) +
+        sizeof(bass_buffer) + sizeof(fft_work) + sizeof(fft_bins) + sizeof(led_bins) +
+        sizeof(envelope) + sizeof(tempo) + sizeof(onsets) + sizeof(strip) + sizeof(intensities) +
+        sizeof(spectrum) + sizeof(effect) + sizeof(broadcast_values) + sizeof(survey) <= 8192 - 4096,
+        "analysis and I/O buffers leave less than 4KB of SRAM for the stack");
 
 
 // timer1 is used for sample clock, initiates conversion 
 // and pushes last conversion result into circular_buffer.
 // fft is run in main loop asynchronously
+// stereo layouts alternate ADMUX between the channels. the first conversion after
+// switching to a differential gain channel is off while the offset cancellation
+// settles (datasheet), so each channel gets two conversions in a row and the first
+// is thrown away: a channel is sampled at a quarter of the timer rate
+// (sampling_init() quadruples it)
 void adc_start_conversion();
-void adc_init();
+void adc_init(uint8_t gain);
+void sampling_init();
+uint8_t adc_mux[2];          // ADMUX of the left and right channel
+volatile uint8_t adc_channel; // channel of the conversion in progress
+volatile bool adc_settled;    // stereo: the conversion in progress is not the first after a switch
 
 ISR(TIMER1_OVF_vect) {
-    circular_buffer.push(ADC >> 2);
+    const uint8_t sample = ADC >> 2;
+    const bool stereo = settings.layout != LAYOUT_MONO;
+    if(stereo && !adc_settled) {
+        // settling conversion, convert the same channel again
+        adc_settled = true;
+        adc_start_conversion();
+        return;
+    }
+    if(adc_channel)
+        right_buffer.push(sample);
+    else {
+        // 256-point mode: the oldest sample moves on to right_buffer
+        if(settings.resolution == RESOLUTION_256 && settings.layout == LAYOUT_MONO &&
+                circular_buffer.full())
+            right_buffer.push(circular_buffer.peek());
+        circular_buffer.push(sample);
+        int8_t decimated;
+        if(settings.resolution == RESOLUTION_MULTI && decimator.push(sample, decimated))
+            bass_buffer.push(decimated);
+    }
+    if(stereo) {
+        adc_channel ^= 1;
+        ADMUX = adc_mux[adc_channel];
+        adc_settled = false;
+    }
     adc_start_conversion();
 }
 
 ISR(ADC_vect) {
 }
 
-// ADC sample rate and downsample ratio
-// samples are taken at a frequency of (samplerate / downsample) hertz
-const int downsample = 16;
-#define samplerate 44100
+// next phase of the volume encoder sequence
+ISR(TIMER2_COMPA_vect) {
+    volume.tick();
+}
+
+// strip refresh at settings.refresh per second, with interrupts enabled so the sample
+// clock keeps running during the draw. main never draws while the renderer runs
+Color intensity_color(uint8_t intensity, uint8_t threshold);
+ISR(TIMER3_COMPA_vect, ISR_NOBLOCK) {
+    static volatile bool drawing = false;
+    if(drawing)
+        return; // the previous refresh is still being drawn
+    drawing = true;
+    const uint32_t start = micros();
+    renderer.render(millis(), strip, intensity_color, settings.threshold);
+    led_strip.draw(strip, settings.brightness);
+    render_us = micros() - start;
+    drawing = false;
+}
+
+// nRF IRQ (PL0 = ICP4) falling edge, drains the radio's RX FIFO
+ISR(TIMER4_CAPT_vect) {
+    nrf.interrupt();
+}
 
 int abs(int value) {
     return value > 0 ? value : -value;
 }
 
+void configure_mode();
+
+void apply_setting(uint8_t id) {
+    switch(id) {
+        case PARAM_GAIN:
+        case PARAM_SAMPLE_RATE:
+        case PARAM_LAYOUT:
+        case PARAM_RESOLUTION:  sampling_init(); break;
+        case PARAM_STREAM:      stream.enable(settings.stream); break;
+        case PARAM_CHANNEL:     nrf.set_freq(settings.channel); break;
+        case PARAM_MODE:        configure_mode(); break;
+        case PARAM_STEP_RATE:   volume.set_rate(settings.step_rate); break;
+        case PARAM_REFRESH:     render_timer_init(settings.refresh); break;
+        case PARAM_EFFECT:      effect.select(settings.effect); break;
+        case PARAM_BEAT:        if(!(settings.beat & BEAT_PALETTE)) palette = 0; break;
+        default: break;
+    }
+    settings_store.changed(millis());
+}
+
+// draw strip[] as it is for key feedback: right away, or by the renderer (held)
+void show() {
+    if(!settings.refresh)
+        led_strip.draw(strip, settings.brightness);
+}
+
+// show the intensities: colored and drawn right away, or handed to the renderer
+void present() {
+    if(settings.refresh) {
+        renderer.push(intensities, millis());
+        return;
+    }
+    for(int i=0; i<strip_length; i++)
+        strip[i] = intensity_color(intensities[i], settings.threshold);
+    led_strip.draw(strip, settings.brightness);
+}
+
+// SRAM statistics (sram.h)
+void report_sram() {
+    SramStats stats;
+    sram_stats(stats);
+    usart.printf_P(PSTR("SRAM: data %u, bss %u, heap %u, stack max %u, free %u (%u at the deepest stack)%s\n"),
+            stats.data, stats.bss, stats.heap, stats.stack_max, stats.free_now, stats.unused,
+            stats.unused < sram_warning ? " LOW" : "");
+}
+
+void analyze();
+
+// run the analysis of every layout for a few frames (silent buffers, both frame kinds
+// of the multi-resolution analyzer) to measure its cost. must run before
+// sampling_init(), the ADC interrupt follows settings.layout. the beat and level
+// tracking start over afterwards, those frames were only a few ms apart
+void measure_layouts() {
+    const uint8_t layout = settings.layout;
+    for(uint8_t l = LAYOUT_MONO; l <= LAYOUT_MID_SIDE; l++) {
+        settings.layout = l;
+        for(uint8_t frame = 0; frame < 4; frame++) {
+            analyze();
+            if(analysis_us > layout_analysis_us[l])
+                layout_analysis_us[l] = analysis_us;
+            if(fft_us > layout_fft_us[l])
+                layout_fft_us[l] = fft_us;
+        }
+    }
+    settings.layout = layout;
+    onsets = OnsetDetector();
+    tempo = TempoTracker();
+    envelope = SpectrumEnvelope<strip_length>();
+    flash = 0;
+    palette = 0;
+}
+
+void report_layouts() {
+    usart.printf_P(PSTR("analysis (fft %u): mono %uus (FFT %uus), mirror %uus (FFT %uus), mid/side %uus (FFT %uus)\n"),
+            settings.resolution, layout_analysis_us[LAYOUT_MONO], layout_fft_us[LAYOUT_MONO],
+            layout_analysis_us[LAYOUT_MIRROR], layout_fft_us[LAYOUT_MIRROR],
+            layout_analysis_us[LAYOUT_MID_SIDE], layout_fft_us[LAYOUT_MID_SIDE]);
+}
+
+// list the effects with their worst cost so far, the selected one marked
+void report_effects() {
+    for(uint8_t id = 0; id < EFFECT_COUNT; id++)
+        usart.printf_P(PSTR("%c%u %S: %uus%s\n"), id == effect.selected() ? '*' : ' ', id,
+                effects[id].name, effect_us[id], effect_us[id] > effect_budget_us ? " over budget" : "");
+}
+
+// run every effect for a few frames of full-scale input to measure its cost,
+// then start the selected one
+void measure_effects() {
+    uint8_t full[strip_length];
+    for(int i=0; i<strip_length; i++)
+        full[i] = 255;
+    const EffectInput input = { full, strip_length, 255, 255, 0, true };
+    for(uint8_t id = 0; id < EFFECT_COUNT; id++) {
+        effect.select(id);
+        for(uint8_t frame = 0; frame < 8; frame++) {
+            const uint32_t start = micros();
+            effect.run(input, intensities);
+            const uint16_t us = micros() - start;
+            if(us > effect_us[id])
+                effect_us[id] = us;
+        }
+    }
+    effect.select(settings.effect);
+}
+
+// handle a single-byte command (from USART or nRF)
+void handle_key(uint8_t key) {
+    renderer.hold(millis() + feedback_ms); // keep the feedback from being rendered over
+    switch(key) {
+        case '+': volume.move(key_accel.steps(1, millis(), 3, settings)); strip[strip_length - 1] = Color(32); break;
+        case '-': volume.move(key_accel.steps(-1, millis(), 3, settings)); strip[0] = Color(32); break;
+        case 's': 
+                  // channel survey results (when the USART isn't carrying the binary stream)
+                  if(!settings.stream) {
+                      for(uint8_t c = CHANNEL_MIN; c <= CHANNEL_MAX; c++)
+                          usart.printf_P(PSTR("%u "), survey.level(c));
+                      usart.printf_P(PSTR("\nquietest %u, current %u\n"), 
+                              survey.quietest(), settings.channel);
+                  }
+                  break;
+        case 't':
+                  // tempo (when the USART isn't carrying the binary stream)
+                  if(!settings.stream)
+                      usart.printf_P(PSTR("%u BPM, confidence %u\n"), tempo.bpm(), tempo.confidence());
+                  break;
+        case 'p':
+                  // analysis cost and free SRAM (when the USART isn't carrying the binary stream)
+                  if(!settings.stream)
+                      usart.printf_P(PSTR("analysis %uus (FFT %uus), layout %u, fft %u, refresh %uus every %u/s (frames %ums), %u bytes free\n"),
+                              analysis_us, fft_us, settings.layout, settings.resolution,
+                              render_us, settings.refresh, renderer.frame_period(), sram_free());
+                  break;
+        case 'e':
+                  // effects and their worst cost (when the USART isn't carrying the binary stream)
+                  if(!settings.stream)
+                      report_effects();
+                  break;
+        case 'm':
+                  // SRAM use (when the USART isn't carrying the binary stream)
+                  if(!settings.stream)
+                      report_sram();
+                  break;
+        case '?': 
+                  // shown by the main loop when the check is done
+                  volume.check();
+                  movable_feedback = true;
+                  break;
+        default: 
+                  for(int i=0; i<8; i++)
+                      strip[i] = Color((0x80 >> i) & key ? 64 : 0);
+                  break;
+    }
+}
+
+// convert sound intensity into color (TODO: make this mimic black-body radiation)
+// red to yellow, the other palettes rotate the color channels
+Color intensity_color(uint8_t intensity, uint8_t threshold) {
+    const uint8_t hot = intensity,
+                  warm = intensity > threshold * 4 ? (intensity - threshold * 4) / 4 : 0;
+    switch(palette) {
+        case 1:  return Color(0, hot, warm);
+        case 2:  return Color(warm, 0, hot);
+        default: return Color(hot, warm, 0);
+    }
+}
+
+const uint8_t broadcast_address[6] = "BNode"; // master -> slave frames (pipe 2, shares 1Node's upper bytes)
+
+void load_ack_status();
+
+// master: a frame is out, send_async() flushed the remote's ACK payload
+void broadcast_sent(bool success, uint8_t retransmits) {
+    load_ack_status();
+}
+
+// master: send the intensities to the slaves, without ACK
+void send_broadcast() {
+    if(nrf.tx_busy()) {
+        broadcast_dropped++; // previous frame still on air
+        return;
+    }
+    uint8_t frame[BROADCAST_FRAME_SIZE];
+    broadcast_encode(frame, ++broadcast_seq, intensities);
+    nrf.send_async(frame, sizeof(frame), broadcast_sent, false);
+}
+
+// slave: keep a received frame for render_broadcast()
+void handle_broadcast(const uint8_t* packet, uint8_t length) {
+    uint8_t seq;
+    if(settings.mode != NODE_SLAVE || !broadcast_decode(packet, length, broadcast_values, &seq))
+        return;
+    broadcast_gap = seq - broadcast_seq;
+    broadcast_seq = seq;
+    broadcast_new = true;
+}
+
+// slave: render the latest frame. after dropped frames the first render is halfway
+// between the old and new frame, without frames the strip holds and then fades out.
+void render_broadcast() {
+    if(broadcast_new) {
+        broadcast_age = 0;
+        const bool blend = broadcast_gap > 1;
+        for(int i=0; i<strip_length; i++)
+            intensities[i] = blend ? (intensities[i] + broadcast_values[i]) / 2 : broadcast_values[i];
+        // show the actual frame next time unless a newer one arrives
+        broadcast_new = blend;
+        broadcast_gap = 1;
+    }
+    else if(broadcast_age < 255 && ++broadcast_age > 3) {
+        for(int i=0; i<strip_length; i++)
+            intensities[i] = intensities[i] * 7 / 8;
+    }
+}
+
+// set up the radio for settings.mode
+void configure_mode() {
+    if(settings.mode == NODE_SLAVE)
+        nrf.setup_rx_pipe(2, broadcast_address, BROADCAST_FRAME_SIZE);
+    else
+        nrf.close_rx_pipe(2);
+    if(settings.mode == NODE_MASTER)
+        nrf.set_tx_addr(broadcast_address, BROADCAST_FRAME_SIZE);
+}
+
+// the remote sees many retransmissions: announce the quietest channel in the ACK
+// payload. the remote only gets it with the ACK to its next packet, so the base
+// switches when that packet arrives (base_link.h), however long that takes.
+// a new survey sweep starts for the next rescan.
+// only standalone nodes move, a master would leave its slaves behind.
+uint8_t rescan() {
+    if(settings.mode != NODE_STANDALONE || !survey.complete())
+        return 0;
+    const uint8_t channel = survey.quietest();
+    survey.restart();
+    return channel == settings.channel ? 0 : channel;
+}
+
+// the rest of the base for the remote protocol (base_link.h)
+struct BaseNode {
+    void move(int16_t steps) { volume.move(steps); }
+    int16_t position() const { return volume.target(); }
+    bool movable() const { return volume.movable(); }
+    bool key(uint8_t value) {
+        const int key = radio_commands.feed(value);
+        if(key >= 0)
+            handle_key(key);
+        return key >= 0;
+    }
+    void broadcast(const uint8_t* packet, uint8_t length) { handle_broadcast(packet, length); }
+    uint8_t rescan() { return ::rescan(); }
+    // the remote was acknowledged with the announcement, it is on its way
+    void switch_channel(uint8_t channel) {
+        settings.channel = channel;
+        apply_setting(PARAM_CHANNEL);
+    }
+    // report the remote's measured latency (when the USART isn't carrying the binary stream)
+    void knob(const KnobPacket& knob, int16_t steps) {
+        if(!settings.stream)
+            usart.printf_P(PSTR("knob %u: %d steps (%d volume), latency %uus\n"), 
+                    knob.seq, knob.delta, steps, knob.latency);
+    }
+} base_node;
+BaseLink<BaseNode> remote_link(nrf, base_node, settings);
+
+// load the status returned in the ACK to the remote's next packet
+void load_ack_status() {
+    remote_link.load_status();
+}
+
+// handle all received nRF packets, returns true if a single-byte command was among them
+bool handle_radio() {
+    return remote_link.poll(millis());
+}
+
+// sample, FFT and compute the strip colors from this node's own input
+// load the samples and FFT them for the layout and resolution. fft_bins gets the
+// spectrum for the onset detector and the stream, returns the per-LED magnitudes
+// and in <fresh> whether fft_bins was updated (multi-resolution: short frames only)
+const uint8_t* transform(bool& fresh) {
+    const bool stereo = settings.layout != LAYOUT_MONO;
+    const bool multi = !stereo && settings.resolution == RESOLUTION_MULTI;
+    fresh = true;
+    if(!stereo && settings.resolution == RESOLUTION_256) {
+        // even samples into the first half of fft_work, odd ones into the second
+        for(int i=0; i<fft_length; i++) {
+            const int even = 2 * i, odd = even + 1;
+            fft_work[i] = even < fft_length ? right_buffer[even] : circular_buffer[even - fft_length];
+            fft_work[fft_length + i] = odd < fft_length ? right_buffer[odd] : circular_buffer[odd - fft_length];
+        }
+        // (not streamed, the samples are split up)
+        const uint32_t fft_start = micros();
+        fix_fftr_mag(fft_work, 8);
+        fft_us = micros() - fft_start;
+        // 128 magnitudes in place, pairs of them for the 21.5Hz spectrum
+        const uint8_t* magnitudes = reinterpret_cast<const uint8_t*>(fft_work);
+        for(int i=0; i<fft_length / 2; i++)
+            fft_bins[i] = magnitudes[2 * i] > magnitudes[2 * i + 1] ? magnitudes[2 * i] : magnitudes[2 * i + 1];
+        spread_bins(magnitudes, fft_length, led_bins, strip_length);
+        return led_bins;
+    }
+    const bool long_frame = multi && multires.long_frame();
+    const uint8_t m = multi ? multires.log2_length() : 7;
+    const int n = 1 << m;
+    // load circular buffer samples into FFT buffer
+    // (stereo: left or mid into the real part, right or side into the imaginary part,
+    // multi-resolution: the decimated samples or the latest n)
+    for(int i=0; i<n; i++) {
+        if(long_frame) {
+            fft_buffer[i] = bass_buffer[i];
+            fft_ibuffer[i] = 0;
+        }
+        else if(!stereo) {
+            fft_buffer[i] = circular_buffer[fft_length - n + i];
+            fft_ibuffer[i] = 0;
+        }
+        else if(settings.layout == LAYOUT_MIRROR) {
+            fft_buffer[i] = circular_buffer[i];
+            fft_ibuffer[i] = right_buffer[i];
+        }
+        else {
+            const int8_t left = circular_buffer[i], right = right_buffer[i];
+            fft_buffer[i] = (left + right) / 2;
+            fft_ibuffer[i] = (left - right) / 2;
+        }
+    }
+    stream.send_samples(fft_buffer, n);
+    
+    // perform forward in-place FFT with 2^m bins
+    const uint32_t fft_start = micros();
+    fix_fft(fft_buffer, fft_ibuffer, m, 0);
+    fft_us = micros() - fft_start;
+
+    if(stereo) {
+        stereo_bins(fft_buffer, fft_ibuffer, fft_length, settings.layout, led_bins, strip_length, fft_bins);
+        return led_bins;
+    }
+    if(multi) {
+        fresh = multires.update(fft_buffer, fft_ibuffer, fft_bins);
+        return multires.bins();
+    }
+    // approximate magnitude as abs(real)/2 + abs(imag)/2
+    for(int i=0; i<fft_length / 2; i++)
+        fft_bins[i] = abs(fft_buffer[i])/2 + abs(fft_ibuffer[i])/2;
+    return fft_bins;
+}
+
+// sample, FFT and compute the strip colors from this node's own input
+void analyze() {
+    const uint32_t start = micros();
+    bool fresh;
+    const uint8_t* bins = transform(fresh);
+
+    // beat effects: flash brighter the stronger the onset, then fade.
+    // onsets and tempo run on the frames with a new spectrum
+    bool onset = false;
+    const uint32_t now = millis();
+    if(fresh) {
+        stream.send_bins(fft_bins, fft_length / 2);
+        // refrac counts 25ms frames, multi-resolution has a new spectrum every other frame
+        const uint32_t refractory = ((uint32_t)settings.refractory * 25 * 16 + tempo.frame_time() / 2) / tempo.frame_time();
+        onset = onsets.update(fft_bins, fft_length / 2, settings.onset_sensitivity, refractory > 255 ? 255 : refractory);
+        tempo.update(onsets.last_flux(), onset, now);
+    }
+    // beat effects: flash brighter the stronger the onset, then fade
+    if(onset) {
+        if(settings.beat & BEAT_FLASH)
+            flash = 64 + onsets.strength() * 3 / 4;
+        if(settings.beat & BEAT_PALETTE)
+            palette = (palette + 1) % 3;
+    }
+    else
+        flash = flash * 3 / 4;
+
+    // pulse that peaks on each beat of the clock and fades until the next
+    uint8_t pulse = 0;
+    if((settings.beat & BEAT_PULSE) && tempo.confidence() >= 128) {
+        const uint8_t fade = 255 - tempo.phase(now);
+        pulse = (uint16_t)fade * fade >> 10;
+    }
+
+    const uint16_t boost = flash / 4 + pulse;
+    envelope.process(bins, spectrum, settings, boost > 255 ? 255 : boost);
+
+    // the effect makes the intensities out of the spectrum and the beat
+    const uint32_t effect_start = micros();
+    const EffectInput input = { spectrum, strip_length, effect_level(spectrum, strip_length),
+        onset ? onsets.strength() : (uint8_t)0, tempo.phase(now), tempo.confidence() >= 128 };
+    effect.run(input, intensities);
+    const uint16_t us = micros() - effect_start;
+    if(us > effect_us[effect.selected()])
+        effect_us[effect.selected()] = us;
+    analysis_us = micros() - start;
+}
+
 const uint8_t remote_address[6] = "2Node"; // remote address
 const uint8_t station_address[6] = "1Node"; // receiver address
 int main() {
+    // load persisted settings (defaults if there are none) before configuring anything
+    settings_store.load(settings);
+    system_timer_init();
+    spi_init(true); // 8MHz SCK, the nRF takes up to 10MHz
+
     // initialize nRF module in TX mode
-    nrf.init();
+    uint16_t spi_bytes = nrf.spi_byte_count();
+    nrf.init(settings.channel);
     nrf.setup_rx_pipe(1, station_address, 1); 
+    nrf.enable_dynamic_payloads(_BV(DPL_P1));
+    const uint16_t init_bytes = nrf.spi_byte_count() - spi_bytes;
+    spi_bytes = nrf.spi_byte_count();
     nrf.start_listening();
-    // initialize ADC and sample timer
-    adc_init();
-    sample_timer_init(samplerate / downsample);
-
-
+    const uint16_t listen_bytes = nrf.spi_byte_count() - spi_bytes;
+    volume.set_rate(settings.step_rate);
+    volume.check(); // done shortly after sei()
+    load_ack_status(); // start_listening() flushed the TX FIFO
+    configure_mode();
+    nrf.enable_irq();
+    nrf.set_clock(micros); // transmit latency statistics
+    capture_interrupt_init();
+    render_timer_init(settings.refresh);
 
     sei();
-    const int alpha = 128;   // for WMA
-    const int threshold = 8; // for LED strip
+    usart.printf_P(PSTR("nrf SPI bytes: init %u, start_listening %u\n"), init_bytes, listen_bytes);
+    // (micros() needs interrupts, the stream stays off meanwhile)
+    measure_layouts();
+    // initialize ADC and sample timer
+    sampling_init();
+    stream.enable(settings.stream);
+    measure_effects();
+    if(!settings.stream) {
+        report_layouts();
+        report_effects();
+        report_sram();
+    }
+    uint16_t frame = 0;
 
     while(1) {
-        _delay_ms(20);
-
-        // load circular buffer samples into FFT buffer
-        for(int i=0; i<circular_buffer.length(); i++) {
-            fft_buffer[i] = circular_buffer[i];
-            fft_ibuffer[i] = 0;
+        // handle knob packets while waiting for samples instead of once per frame
+        for(uint8_t i = 0; i < 20; i++) {
+            if(handle_radio()) {
+                // show the key feedback until the next frame overwrites it
+                show();
+            }
+            _delay_ms(1);
         }
-        
-        // perform forward in-place FFT with m=2^7 (128) bins
-        fix_fft(fft_buffer, fft_ibuffer, 7, 0);
 
-        for(int i=0; i<strip_length; i++)
-        {
-            // approximate magnitude as abs(real)/2 + abs(imag)/2
-            // multiply by 4 and calculate weighted moving average
-            strip_buffer[i] = (strip_buffer[i] * (256 - alpha) + 
-                    (abs(fft_buffer[i])/2 + abs(fft_ibuffer[i])/2) * 4 * alpha) / 256;
-
-            // apply threshold
-            const uint8_t intensity = strip_buffer[i] > threshold ? strip_buffer[i] - threshold / 2: 0;
-
-            // convert sound intensity into color (TODO: make this mimic black-body radiation)
-            strip[i] = Color(intensity, 
-                    intensity > threshold * 4 ? (intensity - threshold * 4) / 4 : 0, 
-                    0);
+        if(settings.mode == NODE_SLAVE)
+            render_broadcast();
+        else {
+            analyze();
+            if(settings.mode == NODE_MASTER)
+                send_broadcast();
         }
+
         // update LED strip
-        led_strip.draw(strip, 4);
-
-        if(usart.available() || nrf.available()){
-            uint8_t packet[32];
-            if(usart.available())
-                packet[0] = usart.read();
-            else if(nrf.available())
-            {
-                nrf.stop_listening();
-                nrf.read(packet);
-                nrf.start_listening();
-                //nrf.flush_rx();
-            }
-                
-
-            switch(packet[0]) {
-                case '+': volume.up(); volume.up();volume.up(); strip[strip_length - 1] = Color(32); break;
-                case '-': volume.down(); volume.down(); volume.down(); strip[0] = Color(32); break;
-                case '?': 
-                          strip[0] = volume.movable() ? Color(1, 255, 0) : Color(255, 0, 0); 
-                          strip[1] = enc_p1 ? Color(64) : Color(0);
-                          strip[2] = enc_p2 ? Color(64) : Color(0);
-                          break;
-                default: 
-                          for(int i=0; i<8; i++)
-                              strip[i] = Color((0x80 >> i) & packet[0] ? 64 : 0);
-                          break;
+        present();
+        stream.send_colors(strip, strip_length);
+        if(frame++ % 64 == 0)
+            stream.send_status(frame);
+
+        // feed USART and nRF input through the command parsers,
+        // single-byte commands fall through to handle_key()
+        bool key_pressed = false;
+        while(usart.available()) {
+            const int key = usart_commands.feed(usart.read());
+            if(key >= 0) {
+                handle_key(key);
+                key_pressed = true;
             }
-            led_strip.draw(strip);
-            _delay_ms(20);
         }
-        // indicate if carrier is detected on LED pin
-        LED_pin = nrf[CD_REG] & 0x01; 
+        key_pressed |= handle_radio();
+        // redraw so the key feedback shows (knob packets don't need this)
+        if(key_pressed)
+            show();
+        if(movable_feedback && !volume.checking()) {
+            movable_feedback = false;
+            renderer.hold(millis() + feedback_ms);
+            strip[0] = volume.movable() ? Color(1, 255, 0) : Color(255, 0, 0); 
+            strip[1] = enc_p1 ? Color(64) : Color(0);
+            strip[2] = enc_p2 ? Color(64) : Color(0);
+            show();
+        }
+
+        // finish transmissions and run their callbacks
+        nrf.service();
+
+        // survey one channel per frame until a sweep is complete (rescan() starts the next)
+        if(settings.mode == NODE_STANDALONE && !nrf.tx_busy() && !survey.complete())
+            survey.step(nrf, settings.channel);
+
+        // write changed settings to EEPROM in the background
+        settings_store.poll(settings, millis());
+        // check how close the stack came to the heap (once the stack could be deep)
+        if(frame % 64 == 32 && !sram_low && sram_unused() < sram_warning) {
+            sram_low = true;
+            if(!settings.stream)
+                report_sram();
+        }
+
+        // indicate if carrier is detected on LED pin (every 16th frame is plenty)
+        if(frame % 16 == 0)
+            LED_pin = nrf[CD_REG] & 0x01; 
     }
 }
 
@@ -181,11 +774,34 @@ void adc_start_conversion() {
     ADCSRA |= _BV(ADSC);
 }
 
-void adc_init() {
-    //ADMUX = _BV(REFS0) | 0x0F; // ADC channel 1+/0-, Vcc reference, 200x gain
-    ADMUX = _BV(REFS0) | 0x0D; // ADC channel 1+/0-, Vcc reference, 10x gain
+void adc_init(uint8_t gain) {
+    if(gain) {
+        adc_mux[0] = _BV(REFS0) | 0x0F; // left: ADC channel 3+/2-, Vcc reference, 200x gain
+        adc_mux[1] = _BV(REFS0) | 0x0B; // right: ADC channel 1+/0-, Vcc reference, 200x gain
+    }
+    else {
+        adc_mux[0] = _BV(REFS0) | 0x0D; // left: ADC channel 3+/2-, Vcc reference, 10x gain
+        adc_mux[1] = _BV(REFS0) | 0x09; // right: ADC channel 1+/0-, Vcc reference, 10x gain
+    }
+    adc_channel = 0;
+    adc_settled = false;
+    ADMUX = adc_mux[0];
     ADCSRA = _BV(ADEN) | _BV(ADIE); // enable ADC, enable interrupt
     ADCSRB = 0;
-    DIDR0 |= _BV(2) | _BV(3);  // disable digital input buffer for channel 0 and 1
+    DIDR0 |= _BV(2) | _BV(3);  // disable digital input buffer for channel 2 and 3
+    if(settings.layout != LAYOUT_MONO)
+        DIDR0 |= _BV(0) | _BV(1); // and 0 and 1 (right channel)
+}
+
+// ADC and sample timer for the current settings, both channels take turns in stereo
+// (two conversions per sample, see adc_settled)
+void sampling_init() {
+    const uint8_t sreg = SREG;
+    cli();
+    adc_init(settings.gain);
+    right_buffer.flush();
+    bass_buffer.flush();
+    sample_timer_init(settings.layout != LAYOUT_MONO ? settings.sample_rate * 4 : settings.sample_rate);
+    SREG = sreg;
 }
 
@@ -8,8 +8,11 @@
 // Copyright Aaron Schraner, 2018
 // 
 
+#include <avr/interrupt.h>
+#include <util/delay.h>
 #include "pin.h"
 #include "spi.h"
+#include "circular_buffer.h"
 #include "nrf_defs.h" // configuration register address definitions
 
 // helper struct for SPI devices
@@ -19,106 +22,271 @@
 struct CS_lock {
     Pin ce_lock; // the CS pin
     CS_lock(Pin ce_lock):ce_lock(ce_lock) {
-        ce_lock = 0; // pull CS low
+        spi_select(ce_lock); // pull CS low
     }
     ~CS_lock() {
-        ce_lock = 1; // drive CS high
+        spi_deselect(ce_lock); // drive CS high
     }
 };
 
 // class for NRF radio
 // TODO: fix private/public methods
+//
+// receiving can be polled (available()/read() talk to the radio directly) or
+// interrupt driven: after enable_irq(), call interrupt() from the interrupt on the
+// IRQ pin's falling edge. it drains the RX FIFO into rx_queue, and available()/read() only
+// touch the queue, so there is no SPI traffic until a packet arrives.
+//
+// the 8-bit configuration registers are shadowed (write-through) once init() has
+// written them, so reading them or changing single bits costs no SPI read-back and
+// writes that wouldn't change anything are skipped. every command clocks STATUS out
+// with its first byte, which is kept in last_status. (the datasheet requires a new
+// CSN falling edge for every command, so commands can't share one chip select.)
+//
+// send_async() queues a payload and returns right away. the transmission completes in
+// the background and is finished by interrupt() (interrupt mode) or service(), which
+// must be called regularly (e.g. once per main loop iteration). service() also runs the
+// completion callback. send() is a blocking wrapper around the same state machine.
+// the payload itself goes out as a background SPI job (see spi.h), transactions
+// started meanwhile queue up behind it.
 class NRF {
+    public:
+        // a received payload
+        struct Packet {
+            uint8_t length, pipe;
+            uint8_t data[32];
+        };
+
+        // completion callback for send_async()
+        // <retransmits> is ARC_CNT from OBSERVE_TX for the packet
+        typedef void (*SendCallback)(bool success, uint8_t retransmits);
+
+        // time source for latency statistics, in microseconds
+        typedef uint32_t (*Clock)();
+
+        // transmit statistics
+        struct TxStats {
+            uint16_t sent;          // acknowledged packets
+            uint16_t failed;        // packets that reached MAX_RT or timed out
+            uint16_t retransmits;   // sum of ARC_CNT over all packets
+            uint16_t last_latency;  // us from send_async() to completion (needs a Clock)
+            uint16_t max_latency;
+            uint32_t total_latency; // for the average: total_latency / (sent + failed)
+        };
+
     private:
         const Pin irq,
               ce,
               cs;
 
+        // received packets (interrupt mode), same depth as the radio's RX FIFO
+        CircularBuffer<Packet, 3> rx_queue;
+        bool irq_mode;
+        volatile uint8_t busy;  // SPI transactions in progress (see Lock)
+        volatile bool deferred; // interrupt() arrived during a transaction
+
+        uint8_t shadow[FEATURE + 1]; // last value written to each 8-bit config register
+        bool shadow_valid;           // set once init() has written every shadowed register
+        uint8_t last_status;         // STATUS as returned by the latest command
+        uint16_t spi_bytes;          // bytes transferred, for measuring operations
+
+        // transmit state machine
+        enum TxState: uint8_t {
+            TX_IDLE,
+            TX_SENDING, // CE is high, waiting for TX_DS or MAX_RT
+            TX_DONE     // finished, callback not run yet
+        };
+        volatile TxState tx_state;
+        bool tx_success;
+        uint8_t tx_retransmits;
+        bool tx_was_listening;  // return to RX mode after sending
+        SendCallback tx_callback;
+        Clock clock;
+        uint32_t tx_started;    // clock() at send_async()
+        TxStats stats;
+
+        // background payload write of send_async()
+        SPIJob tx_job;
+        uint8_t tx_buffer[33];
+
+        // begin transmitting once the payload is in the TX FIFO. CE stays high until
+        // the transmission completes, so the radio also goes through power up (1.5ms)
+        // and TX settling (130us) on its own if it was powered down
+        static void payload_written(void* context) {
+            static_cast<NRF*>(context)->ce = 1;
+        }
+
+        // a transmission that takes longer than this failed (radio not responding)
+        static const uint32_t tx_timeout = 100000; // us
+
+        // registers that change on their own or are wider than 8 bits aren't shadowed
+        static bool shadowed(uint8_t address) {
+            return address <= FEATURE && address != STATUS && address != OBSERVE_TX && 
+                address != CD_REG && address != RX_ADDR_P0 && address != RX_ADDR_P1 && 
+                address != TX_ADDR && address != FIFO_STATUS;
+        }
+
+        // one SPI transaction: <command>, then <length> bytes from <tx> (zeros if 0),
+        // with the bytes clocked out stored in <rx> (if not 0). runs as one job of the
+        // SPI queue and waits for it. keeps and returns STATUS, which the radio
+        // returns with the command byte.
+        uint8_t transaction(uint8_t command, const uint8_t* tx = 0, uint8_t* rx = 0, uint8_t length = 0) {
+            uint8_t buffer[33];
+            buffer[0] = command;
+            for(uint8_t i=0; i<length; i++)
+                buffer[i + 1] = tx ? tx[i] : 0;
+            Lock l(*this);
+            spi_transfer(cs, buffer, buffer, length + 1);
+            spi_bytes += length + 1;
+            if(rx)
+                for(uint8_t i=0; i<length; i++)
+                    rx[i] = buffer[i + 1];
+            return last_status = buffer[0];
+        }
+
+        // marks the radio busy for a sequence of transactions, so interrupt()
+        // doesn't start one in the middle of it.
+        // an interrupt that had to wait is handled when the last lock is released.
+        class Lock {
+            private:
+                NRF& owner;
+            public:
+                Lock(NRF& owner): owner(owner) {
+                    owner.busy++;
+                }
+                ~Lock() {
+                    if(--owner.busy == 0 && owner.deferred)
+                        owner.handle_irq();
+                }
+        };
+
+        // read STATUS with a NOP (1 byte)
+        uint8_t read_status() {
+            return transaction(0xFF);
+        }
+
+        // finish a transmission, <status> has TX_DS or MAX_RT set
+        void finish_tx(uint8_t status) {
+            ce = 0;
+            tx_success = status & _BV(TX_DS);
+            tx_retransmits = (read_reg8(OBSERVE_TX) >> ARC_CNT) & 0x0F;
+            if(!tx_success)
+                flush_tx(); // the failed payload stays in the FIFO otherwise
+            write_reg8(STATUS, _BV(TX_DS) | _BV(MAX_RT));
+            if(tx_was_listening) {
+                set_bit(CONFIG, PRIM_RX, 1);
+                ce = 1; // listening again after 130us
+            }
+            tx_state = TX_DONE;
+        }
+
+        // handle whatever the radio is signalling on the IRQ pin:
+        // finish a transmission on TX_DS/MAX_RT, and in interrupt mode clear RX_DR,
+        // then move everything in the RX FIFO into rx_queue.
+        // clearing first means a packet arriving meanwhile causes a new IRQ edge.
+        // the radio stays busy throughout, so the interrupt can't push onto
+        // rx_queue at the same time when this runs outside of it.
+        void handle_irq() {
+            do {
+                busy++;
+                deferred = false;
+                const uint8_t status = read_status();
+                if(tx_state == TX_SENDING && (status & (_BV(TX_DS) | _BV(MAX_RT))))
+                    finish_tx(status);
+                if(!irq_mode || !(status & _BV(RX_DR))) {
+                    busy--;
+                    continue;
+                }
+                write_reg8(STATUS, _BV(RX_DR));
+                for(;;) {
+                    const uint8_t pipe = (read_status() >> RX_P_NO) & 0x07;
+                    if(pipe == 0x07) // RX FIFO empty
+                        break;
+                    Packet packet;
+                    packet.pipe = pipe;
+                    packet.length = read_rx_payload(packet.data, pipe);
+                    rx_queue.push(packet); // overwrites the oldest packet if full
+                }
+                busy--;
+            } while(deferred);
+        }
+
         // read an 8-bit configuration register at given address
+        // (from the shadow copy if there is one, STATUS with a 1-byte NOP)
         uint8_t read_reg8(uint8_t address) {
-            CS_lock cl(cs);
-            spi_send(address & 0x1F);
-            return spi_read();
+            address &= 0x1F;
+            if(shadow_valid && shadowed(address))
+                return shadow[address];
+            if(address == STATUS)
+                return read_status();
+            uint8_t data;
+            transaction(address, 0, &data, 1);
+            return data;
         }
 
         // write an 8-bit register value
+        // (skipped if the shadow copy shows it already holds <data>)
         void write_reg8(uint8_t address, uint8_t data) {
-            CS_lock cl(cs);
-            spi_send(0x20 | (address & 0x1F));
-            spi_send(data);
+            address &= 0x1F;
+            if(shadowed(address)) {
+                if(shadow_valid && shadow[address] == data)
+                    return;
+                shadow[address] = data;
+            }
+            transaction(0x20 | address, &data, 0, 1);
         }
 
         // read an N-bit configuration register
         void read_regN(uint8_t address, uint8_t *data, uint8_t length) {
-            CS_lock cl(cs);
-            spi_send(address & 0x1F);
-            for(int i=0; i<length; i++)
-                data[i] = spi_read();
+            transaction(address & 0x1F, 0, data, length);
         }
 
         // write an N-bit configuration register
         void write_regN(uint8_t address, const uint8_t* data, uint8_t length) {
-            CS_lock cl(cs);
-            spi_send(0x20 | (address & 0x1F));
-            for(int i=0; i<length; i++)
-                spi_send(data[i]);
+            transaction(0x20 | (address & 0x1F), data, 0, length);
         }
 
         // read the last received payload width
         uint8_t read_rx_pl_width() {
-            CS_lock cl(cs);
-            spi_send(0x60); // R_RX_PL_WID
-            return spi_read();
+            uint8_t width;
+            transaction(0x60, 0, &width, 1); // R_RX_PL_WID
+            return width;
         }
 
         // read the RX payload into a buffer
         // buffer must be at least 32 bytes to guarantee safety
         // returns length of payload in bytes
-        int read_rx_payload(uint8_t* data) {
-            int length = read_rx_pl_width(); //get payload length
-            CS_lock cl(cs);
-            spi_send(0x61); // R_RX_PAYLOAD
-
-            // put the payload into <data>
-            for(int i=0; i<length; i++)
-                data[i] = spi_read();
+        // <pipe> is the pipe the payload arrived on (RX_P_NO of a recent STATUS)
+        int read_rx_payload(uint8_t* data, uint8_t pipe) {
+            // payload length, from the shadow copy of RX_PW_Px unless the pipe
+            // uses dynamic payload lengths
+            int length = shadow_valid && pipe < 6 && !(shadow[DYNPD] & _BV(pipe)) ? 
+                shadow[RX_PW_P0 + pipe] : read_rx_pl_width();
+            if(length > 32)
+                length = 32;
+            transaction(0x61, 0, data, length); // R_RX_PAYLOAD
 
             return length;
         }
 
         // write a payload to the TX payload register
-        void write_tx_payload(const uint8_t* data, uint8_t length) {
-            CS_lock cl(cs);
-            spi_send(0xA0);
-            int i;
-            for(i=0; i<length; i++)
-                spi_send(data[i]);
-            //for(;i<32; i++) // pad with zeros
-            //    spi_send(0);
+        // (W_TX_PAYLOAD_NOACK if <ack> is false, needs EN_DYN_ACK)
+        void write_tx_payload(const uint8_t* data, uint8_t length, bool ack = true) {
+            transaction(ack ? 0xA0 : 0xB0, data, 0, length);
         }
 
         // flush TX FIFO
         void flush_tx() {
-            CS_lock cl(cs);
-            spi_send(0xE1);
+            transaction(0xE1);
         }
         
         // flush RX FIFO
         void flush_rx() {
-            CS_lock cl(cs);
-            spi_send(0xE2);
+            transaction(0xE2);
         }
 
-        // write a payload to be sent back to the transmitter along with the next ACK
-        // (for a given pipe)
-        void write_ack_payload(uint8_t pipe, const uint8_t* data, uint8_t length) {
-            CS_lock cl(cs);
-            spi_send(0xA8 | pipe);
-            for(int i=0; i<length; i++)
-                spi_send(data[i]);
-        }
-        
-        // set a given bit in 
+        // set a given bit in a shadowed register
+        // (STATUS bits are write-1-to-clear, use write_reg8(STATUS, _BV(bit)) for those)
         void set_bit(uint8_t reg_addr, uint8_t bit, uint8_t value) {
             uint8_t reg = read_reg8(reg_addr);
             if(value)
@@ -165,7 +333,11 @@ class NRF {
         };
 
         // Constructor - initializes pins as output and initializes SPI
-        NRF(Pin irq, Pin ce, Pin cs): irq(irq), ce(ce), cs(cs) {
+        NRF(Pin irq, Pin ce, Pin cs): irq(irq), ce(ce), cs(cs), 
+            irq_mode(false), busy(0), deferred(false), 
+            shadow_valid(false), last_status(0), spi_bytes(0),
+            tx_state(TX_IDLE), tx_success(false), tx_retransmits(0), tx_was_listening(false),
+            tx_callback(0), clock(0), tx_started(0), stats(), tx_job() {
             irq.mode(INPUT);
             ce.mode(OUTPUT);
             cs.mode(OUTPUT);
@@ -173,19 +345,36 @@ class NRF {
             ce.set(0);
             cs.set(1);
         }
-        void init() {
+        // every shadowed register is written here, the radio may still hold
+        // values from before an MCU reset
+        void init(uint8_t channel = 76) {
             _delay_ms(5); 
+            shadow_valid = false; // force the writes below
+
+            reg(CONFIG) = _BV(MASK_RX_DR) | _BV(MASK_TX_DS) | 
+                _BV(MASK_MAX_RT) | _BV(EN_CRC) | _BV(CRC0); // 2-byte CRC enabled, interrupts disabled
+
+            reg(EN_AA) = 0x3F;     // auto-ack on all pipes (reset value)
+            reg(EN_RXADDR) = 0x03; // pipes 0 and 1 enabled (reset value)
+            reg(SETUP_AW) = 0x03;  // 5-byte addresses
+
             // 2250us retransmit delay, max 15 retransmissions
             reg(SETUP_RETR) = (0b0100 << ARD) | (0b1111 << ARC); 
             
+            set_freq(channel); 
             reg(RF_SETUP) = (0x3 << RF_PWR) | (0 << RF_DR); // maximum power, 1Mbps data rate
-            
-            reg(CONFIG) = _BV(MASK_RX_DR) | _BV(MASK_TX_DS) | 
-                _BV(MASK_MAX_RT) | _BV(EN_CRC) | _BV(CRC0); // 2-byte CRC enabled, interrupts disabled
+
+            // pipe 2-5 address bytes and payload widths (reset values)
+            for(uint8_t pipe=2; pipe<6; pipe++)
+                write_reg8(RX_ADDR_P0 + pipe, 0xC1 + pipe);
+            for(uint8_t pipe=0; pipe<6; pipe++)
+                write_reg8(RX_PW_P0 + pipe, 0);
 
             reg(DYNPD) = 0; // disable dynamic-length payloads
+            reg(FEATURE) = 0;
+            shadow_valid = true;
+
             reg(STATUS) = _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT); 
-            set_freq(76); 
             flush_rx();
             flush_tx();
         }
@@ -232,10 +421,7 @@ class NRF {
             ce = 0; // pulse CE to send packet, step 11
             _delay_ms(1); // step 12
             ce = 1; // step 13
-            {
-                CS_lock cl(cs);
-                spi_send(0xE3); //packet retransmit command, packets will repeat continuously until CE goes low
-            }
+            transaction(0xE3); //packet retransmit command, packets will repeat continuously until CE goes low
         }
 
         // assumes 5-byte address length, forces fixed payload length
@@ -244,10 +430,12 @@ class NRF {
             // step 1
             // set_bit(EN_AA, pipe, 1); // enable auto-ack for pipe
             // set_bit(CONFIG, PRIM_RX, 1); // set RX mode
+            // pipes 2-5 only have their own least significant byte (written first),
+            // the other 4 are shared with pipe 1
             if(pipe < 2)
                 write_regN(RX_ADDR_P0 + pipe, address, 5);
             else
-                write_reg8(RX_ADDR_P0 + pipe, address[4]);
+                write_reg8(RX_ADDR_P0 + pipe, address[0]);
 
             write_reg8(RX_PW_P0 + pipe, pl_length); // set payload width
 
@@ -257,53 +445,215 @@ class NRF {
             // monitoring will begin after 130us (step 3)
 
         }
+        // stop receiving on <pipe>
+        void close_rx_pipe(int pipe) {
+            set_bit(EN_RXADDR, pipe, 0);
+        }
+
+        // use dynamic payload lengths on <pipes> (DYNPD bits) and allow ACK payloads.
+        // needs auto-ack on those pipes, a transmitter receiving ACK payloads needs
+        // it on pipe 0. setup_rx_pipe()'s payload width is ignored on these pipes.
+        void enable_dynamic_payloads(uint8_t pipes) {
+            reg(FEATURE) |= _BV(EN_DPL) | _BV(EN_ACK_PAY);
+            reg(DYNPD) = pipes;
+        }
+
+        // write a payload to be sent back to the transmitter along with the next ACK
+        // (for a given pipe). it stays in the TX FIFO until a packet arrives on that pipe.
+        void write_ack_payload(uint8_t pipe, const uint8_t* data, uint8_t length) {
+            transaction(0xA8 | pipe, data, 0, length);
+        }
+
+        // unmask the RX_DR interrupt and switch to interrupt driven receiving
+        // call interrupt() on every falling edge of the IRQ pin after this
+        void enable_irq() {
+            set_bit(CONFIG, MASK_RX_DR, 0);
+            irq_mode = true;
+        }
+
+        // back to polled receiving (masks RX_DR again)
+        void disable_irq() {
+            const uint8_t sreg = SREG;
+            cli();
+            irq_mode = false;
+            rx_queue.flush();
+            SREG = sreg;
+            set_bit(CONFIG, MASK_RX_DR, 1);
+        }
+
+        // IRQ pin handler (interrupt mode)
+        void interrupt() {
+            if(busy)
+                deferred = true;
+            else
+                handle_irq();
+        }
+
         bool available() { // return number of available bytes in last packet rx'd
-            return reg(STATUS) & _BV(6); // read RX_DR bit in status register
-            // appendix A (receive) step 4
+            if(irq_mode) {
+                // IRQ still asserted with nothing queued: an edge was missed
+                // (e.g. a packet arrived before the interrupt was enabled)
+                if(rx_queue.empty() && !irq)
+                    interrupt();
+                return !rx_queue.empty();
+            }
+            // RX_P_NO is 7 when the RX FIFO is empty (RX_DR alone misses a second
+            // payload that was already waiting when the first one was read)
+            return ((read_status() >> RX_P_NO) & 0x07) != 0x07;
         }
 
         // return received packet length, put pipe in <pipe> if present
         uint8_t read(uint8_t* data, uint8_t* pipe = 0) { 
-            if(pipe) {
-                uint8_t status = reg(STATUS);
-                *pipe = (status & 0xE) >> 1; // fetch pipe number from RX_P_NO in status reg
+            if(irq_mode) {
+                // the interrupt pushes onto rx_queue, keep it out while popping
+                const uint8_t sreg = SREG;
+                cli();
+                if(rx_queue.empty()) {
+                    SREG = sreg;
+                    return 0;
+                }
+                const Packet packet = rx_queue.pop();
+                SREG = sreg;
+                const uint8_t length = packet.length > 32 ? 32 : packet.length;
+                for(uint8_t i=0; i<length; i++)
+                    data[i] = packet.data[i];
+                if(pipe)
+                    *pipe = packet.pipe;
+                return length;
             }
             bool ce_state = ce;
             ce = 0; // temporarily disable CE while data is read in
-            int length = read_rx_payload(data);
-            set_bit(STATUS, RX_DR, 1); // clear RX data ready interrupt
+            const uint8_t rx_pipe = (read_status() >> RX_P_NO) & 0x07; // RX_P_NO in status reg
+            if(pipe)
+                *pipe = rx_pipe;
+            int length = read_rx_payload(data, rx_pipe);
+            write_reg8(STATUS, _BV(RX_DR)); // clear RX data ready interrupt
             ce = ce_state; // return CE to previous state
             return length;
         }
 
         // from appendix A of nRF datasheet
         // this method assumes that pipe 0 has already been configured with correct RX address
-        void send(const uint8_t* data, uint8_t length) {
-            set_bit(CONFIG, PRIM_RX, 0); // step 1
-            _delay_us(150);
-            write_tx_payload(data, length); // set TX payload data
-            
-            // begin transmitting 
-            ce = 1;
-            _delay_us(15); // at least 10us is required to guarantee successful transmission
+        // queues <data> for transmission and returns immediately, false if a transmission
+        // is still in progress. <callback> is run by service() once it has completed.
+        // with <ack> false the packet is sent once without asking for an ACK 
+        // (for broadcasts), it completes successfully as soon as it has been sent.
+        // in RX mode, ACK payloads waiting in the TX FIFO are flushed first.
+        bool send_async(const uint8_t* data, uint8_t length, SendCallback callback = 0, 
+                bool ack = true) {
+            if(tx_state != TX_IDLE)
+                return false;
+            const bool prx = read_reg8(CONFIG) & _BV(PRIM_RX);
+            tx_was_listening = prx && ce;
             ce = 0;
+            // ACK payloads share the TX FIFO, the first one would go out ahead of
+            // <data> as an ordinary packet. drop them, reload them in <callback>
+            if(prx && (read_reg8(FEATURE) & _BV(EN_ACK_PAY)))
+                flush_tx();
+
+            // TX mode (step 1), powered up, TX_DS and MAX_RT drive the IRQ pin
+            write_reg8(CONFIG, (read_reg8(CONFIG) | _BV(PWR_UP)) & 
+                    ~(_BV(PRIM_RX) | _BV(MASK_TX_DS) | _BV(MASK_MAX_RT)));
+            if(!ack)
+                set_bit(FEATURE, EN_DYN_ACK, 1);
+
+            tx_callback = callback;
+            if(clock)
+                tx_started = clock();
+            tx_state = TX_SENDING;
+
+            // the payload is written in the background, payload_written() raises CE
+            if(length > 32)
+                length = 32;
+            tx_buffer[0] = ack ? 0xA0 : 0xB0; // W_TX_PAYLOAD(_NOACK)
+            for(uint8_t i=0; i<length; i++)
+                tx_buffer[i + 1] = data[i];
+            tx_job.cs = &cs;
+            tx_job.tx = tx_buffer;
+            tx_job.rx = 0;
+            tx_job.length = length + 1;
+            tx_job.callback = payload_written;
+            tx_job.context = this;
+            spi_bytes += length + 1;
+            spi_queue(tx_job);
+            return true;
+        }
+
+        // advance the transmit state machine and run the completion callback
+        void service() {
+            if(tx_state == TX_SENDING) {
+                if(!irq)
+                    interrupt(); // TX_DS or MAX_RT (or RX_DR) is pending
+                else if(clock && clock() - tx_started > tx_timeout) {
+                    busy++;
+                    finish_tx(_BV(MAX_RT));
+                    busy--;
+                }
+            }
+            if(tx_state != TX_DONE)
+                return;
 
-            while(!(reg(STATUS) & (_BV(MAX_RT) | _BV(TX_DS))));
+            // statistics
+            if(tx_success)
+                stats.sent++;
+            else
+                stats.failed++;
+            stats.retransmits += tx_retransmits;
+            if(clock) {
+                const uint32_t latency = clock() - tx_started;
+                stats.last_latency = latency > 0xFFFF ? 0xFFFF : latency;
+                if(stats.last_latency > stats.max_latency)
+                    stats.max_latency = stats.last_latency;
+                stats.total_latency += latency;
+            }
+
+            tx_state = TX_IDLE;
+            if(tx_callback)
+                tx_callback(tx_success, tx_retransmits);
+        }
+
+        // true while a transmission is in progress or its callback hasn't run yet
+        bool tx_busy() const {
+            return tx_state != TX_IDLE;
+        }
+
+        const TxStats& tx_stats() const {
+            return stats;
+        }
+
+        // use <c> (returning microseconds) to measure transmit latency
+        void set_clock(Clock c) {
+            clock = c;
+        }
+
+        // blocking send, powers the radio down afterwards
+        // returns true if the packet was acknowledged
+        bool send(const uint8_t* data, uint8_t length) {
+            while(!send_async(data, length))
+                service();
+            while(tx_busy())
+                service();
             power_down();
-            flush_tx();
+            return tx_success;
         }
         void config_retransmission(uint8_t retransmits, uint8_t delay) {
             reg(SETUP_RETR) = (delay << ARD) | (retransmits << ARC);
         }
         void start_listening() {
+            // coming out of power down takes 1.5ms before RX can start
+            const bool powered = read_reg8(CONFIG) & _BV(PWR_UP);
+
             //enable PRIM_RX and PWR_UP in config register
             reg(CONFIG) |= _BV(PWR_UP) | _BV(PRIM_RX);
-
-            // clear interrupt requests
-            reg(STATUS) = _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT);
+            if(!powered)
+                _delay_us(1500);
 
             flush_rx();
             flush_tx();
+
+            // clear interrupt requests (flush_tx() just returned STATUS)
+            if(last_status & (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT)))
+                reg(STATUS) = _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT);
             
             ce.set(HIGH);
 
@@ -316,6 +666,28 @@ class NRF {
             //flush_tx();
         }
 
+        // listen again after stop_listening() (no FIFO flush, PRIM_RX must still be set)
+        // RX starts 130us later
+        void resume_listening() {
+            ce.set(HIGH);
+        }
+
+        // current RF channel
+        uint8_t channel() {
+            return read_reg8(RF_CH);
+        }
+
+        // carrier detect (RPD on the nRF24L01+): a signal above -64dBm (-60dBm for the
+        // nRF24L01's CD) on the channel, needs RX mode for at least 170us
+        bool carrier() {
+            return read_reg8(CD_REG) & _BV(CD);
+        }
+
+        // SPI bytes transferred so far (wraps), for measuring the cost of operations
+        uint16_t spi_byte_count() const {
+            return spi_bytes;
+        }
+
 };
 
 #endif
@@ -90,4 +90,17 @@ enum NRF_register: uint8_t {
 // CD (0x09)
 #define         CD          0 // carrier detect
 
+// DYNPD (0x1C)
+#define         DPL_P5      5
+#define         DPL_P4      4
+#define         DPL_P3      3
+#define         DPL_P2      2
+#define         DPL_P1      1
+#define         DPL_P0      0
+
+// FEATURE (0x1D)
+#define         EN_DPL      2 // dynamic payload length
+#define         EN_ACK_PAY  1 // payload with ACK
+#define         EN_DYN_ACK  0 // W_TX_PAYLOAD_NOACK command
+
 #endif
@@ -0,0 +1,136 @@
+//////////////////////////////
+// onset.h
+//
+// spectral flux onset (beat) detector working on the FFT magnitudes of each frame
+// Copyright Aaron Schraner, 2018
+//
+// the bins are grouped into bands, each band's flux is the sum of the bins' rises
+// since the previous frame (falls count nothing) divided by the band's width, so the
+// few bins of a kick drum weigh as much as the many of a hi-hat. a frame whose total
+// flux exceeds an adaptive threshold (median plus a multiple of the mean of the last
+// 16 frames) is an onset, unless one was detected less than a refractory period ago.
+// integer math only, about 64 subtractions and a 16 entry sort per frame.
+//
+
+#ifndef ONSET_H
+#define ONSET_H
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// beat effects (the "beat" parameter)
+#define BEAT_FLASH   0x01 // brighten the strip on every onset
+#define BEAT_PALETTE 0x02 // move to the next color palette on every onset
+#define BEAT_PULSE   0x04 // pulse on the tempo.h beat clock once the tempo is locked
+
+class OnsetDetector {
+    public:
+        static const uint8_t bands = 8;
+        static const uint8_t max_bins = 64;
+
+    private:
+        static const uint8_t history_length = 16;
+
+        uint8_t previous[max_bins];           // magnitudes of the previous frame
+        uint16_t history[history_length];     // recent total flux, oldest overwritten
+        uint8_t history_index;
+        uint8_t since;                        // frames since the last onset
+        uint16_t flux, limit;                 // total flux and threshold of the last frame
+        uint8_t onset_strength, onset_band;
+
+        // first bin of each band (bin 0 is DC), the last entry ends the last band
+        static uint8_t band_start(uint8_t band) {
+            static const uint8_t starts[bands + 1] PROGMEM = { 1, 2, 4, 6, 10, 16, 24, 40, 64 };
+            return pgm_read_byte(&starts[band]);
+        }
+
+        // median and mean of the history
+        void statistics(uint16_t& median, uint16_t& mean) const {
+            uint16_t sorted[history_length];
+            uint32_t sum = 0;
+            for(uint8_t i = 0; i < history_length; i++) {
+                // insertion sort
+                uint8_t j = i;
+                for(; j > 0 && sorted[j - 1] > history[i]; j--)
+                    sorted[j] = sorted[j - 1];
+                sorted[j] = history[i];
+                sum += history[i];
+            }
+            median = (sorted[history_length / 2 - 1] + sorted[history_length / 2]) / 2;
+            mean = sum / history_length;
+        }
+
+    public:
+        OnsetDetector(): previous(), history(), history_index(0), since(255),
+            flux(0), limit(0), onset_strength(0), onset_band(0) {}
+
+        // feed the magnitudes of one frame (<count> bins, at most max_bins).
+        // <sensitivity> scales the mean in the threshold (in 1/16ths, more is less
+        // sensitive), <refractory> is the least number of frames between onsets.
+        // returns true if this frame is an onset
+        bool update(const uint8_t* bins, uint8_t count, uint8_t sensitivity, uint8_t refractory) {
+            if(count > max_bins)
+                count = max_bins;
+            uint16_t total = 0, strongest = 0;
+            for(uint8_t b = 0; b < bands; b++) {
+                const uint8_t start = band_start(b);
+                uint8_t end = band_start(b + 1);
+                if(end > count)
+                    end = count;
+                if(start >= end)
+                    break;
+                uint16_t rise = 0;
+                for(uint8_t i = start; i < end; i++)
+                    if(bins[i] > previous[i])
+                        rise += bins[i] - previous[i];
+                const uint16_t band_flux = rise * 4 / (end - start);
+                total += band_flux;
+                if(band_flux > strongest) {
+                    strongest = band_flux;
+                    onset_band = b;
+                }
+            }
+            for(uint8_t i = 0; i < count; i++)
+                previous[i] = bins[i];
+
+            uint16_t median, mean;
+            statistics(median, mean);
+            flux = total;
+            limit = median + (uint32_t)mean * sensitivity / 16 + 8; // + 8: silence isn't a beat
+            history[history_index] = total;
+            history_index = (history_index + 1) % history_length;
+            if(since < 255)
+                since++;
+
+            if(total <= limit || since < refractory)
+                return false;
+            since = 0;
+            const uint32_t strength = (uint32_t)(total - limit) * 255 / limit;
+            onset_strength = strength > 255 ? 255 : strength;
+            return true;
+        }
+
+        // how far the last onset exceeded the threshold (255: twice the threshold or more)
+        uint8_t strength() const {
+            return onset_strength;
+        }
+
+        // band (0 = lowest) with the largest flux in the last frame
+        uint8_t band() const {
+            return onset_band;
+        }
+
+        // frames since the last onset (up to 255)
+        uint8_t frames_since() const {
+            return since;
+        }
+
+        // total flux and threshold of the last frame
+        uint16_t last_flux() const {
+            return flux;
+        }
+        uint16_t threshold() const {
+            return limit;
+        }
+};
+
+#endif
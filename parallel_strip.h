@@ -0,0 +1,132 @@
+//////////////////////////////
+// parallel_strip.h
+//
+// bit-sliced output for up to 7 DotStar strips sharing one clock on one port
+// Copyright Aaron Schraner, 2018
+//
+// bit 0 of the port is the clock, bits 1 to STRIPS are the strips' data lines. the
+// pixels are split into STRIPS equal segments, segment s goes to the strip on bit
+// s + 1, so the pixel count must be a multiple of STRIPS. for every LED the 32-bit
+// words of all strips are transposed into 32 bit-planes (transpose_planes(), an 8x8
+// bit matrix transpose per byte that costs the same for any number of strips), then
+// each bit time is two port writes: data with the clock low, then the clock high,
+// which clocks all strips at once. a draw takes about as long as one strip of the
+// segment length, instead of STRIPS times as long.
+//
+// the other bits of the port are written back as they were at the start of the draw,
+// so nothing else may change them meanwhile (the volume encoder on PORTA only
+// changes DDRA, its PORTA bits stay 0). RESERVED has the bits of the port that are
+// used by something else, the clock and data lines may not be on them: with the
+// encoder on PA3, PA5 and PA7 up to 2 strips fit on PORTA.
+//
+
+#ifndef PARALLEL_STRIP_H
+#define PARALLEL_STRIP_H
+#include <stdint.h>
+#include <stddef.h>
+#include "led_strip.h"
+
+// transpose the bytes of <count> (up to 8) strips into 8 bit-planes, most significant
+// bit first: bit s of planes[b] is bit 7 - b of bytes[s]
+inline void transpose_planes(const uint8_t* bytes, uint8_t count, uint8_t* planes) {
+    uint8_t x[8];
+    for(uint8_t s = 0; s < 8; s++)
+        x[s] = s < count ? bytes[s] : 0;
+    // swap the off-diagonal 4x4, then 2x2, then 1x1 blocks: bit s of x[b] becomes
+    // bit b of bytes[s] (12 masked swaps, whatever the count)
+    for(uint8_t s = 0; s < 4; s++) {
+        const uint8_t t = ((x[s] >> 4) ^ x[s + 4]) & 0x0F;
+        x[s + 4] ^= t;
+        x[s] ^= t << 4;
+    }
+    for(uint8_t s = 0; s < 4; s++) {
+        const uint8_t i = s + (s & 2); // 0, 1, 4, 5
+        const uint8_t t = ((x[i] >> 2) ^ x[i + 2]) & 0x33;
+        x[i + 2] ^= t;
+        x[i] ^= t << 2;
+    }
+    for(uint8_t s = 0; s < 4; s++) {
+        const uint8_t i = 2 * s;
+        const uint8_t t = ((x[i] >> 1) ^ x[i + 1]) & 0x55;
+        x[i + 1] ^= t;
+        x[i] ^= t << 1;
+    }
+    for(uint8_t b = 0; b < 8; b++)
+        planes[b] = x[7 - b];
+}
+
+template <uint8_t STRIPS, uint8_t RESERVED = 0>
+class ParallelStrip {
+    static_assert(STRIPS >= 1 && STRIPS <= 7, "1 to 7 strips (bit 0 is the clock)");
+
+    private:
+        volatile uint8_t& port;
+        static const uint8_t clock = 0x01;
+        static const uint8_t mask = ((1 << (STRIPS + 1)) - 1); // clock and data lines
+        static_assert(!(mask & RESERVED), "the clock or a data line is on a reserved pin");
+
+        // clock out 32 bit-planes (data lines only, bit 0 of each is the lowest strip)
+        void send_planes(const uint8_t* planes, uint8_t base) const {
+            for(uint8_t b = 0; b < 32; b++) {
+                const uint8_t data = base | (planes[b] << 1);
+                port = data;
+                port = data | clock;
+            }
+        }
+
+        // the same 32-bit word on every strip (start and end frames)
+        void send_all(uint32_t word, uint8_t base) const {
+            for(uint32_t r = 1UL << 31; r; r >>= 1) {
+                const uint8_t data = base | (word & r ? mask & ~clock : 0);
+                port = data;
+                port = data | clock;
+            }
+        }
+
+    public:
+        ParallelStrip(volatile uint8_t& port): port(port) {
+            port &= ~mask;
+            *(&port + (&DDRB - &PORTB)) |= mask; // outputs
+        }
+
+        // the 32 port data values (before the shift onto the data lines) for one LED of
+        // each strip: words[s] is the 32-bit DotStar word of strip s
+        static void encode(const uint32_t* words, uint8_t* planes) {
+            if(STRIPS == 1) { // nothing to transpose
+                uint32_t word = words[0];
+                for(uint8_t b = 0; b < 32; b++) {
+                    planes[b] = word >> 31;
+                    word <<= 1;
+                }
+                return;
+            }
+            for(uint8_t byte = 0; byte < 4; byte++) {
+                uint8_t bytes[STRIPS];
+                for(uint8_t s = 0; s < STRIPS; s++)
+                    bytes[s] = words[s] >> (24 - 8 * byte);
+                transpose_planes(bytes, STRIPS, planes + 8 * byte);
+            }
+        }
+
+        // draw <pixels>, split into STRIPS segments
+        template <size_t N>
+        void draw(const Color (&pixels)[N], int brightness = 4) const {
+            static_assert(N % STRIPS == 0, "the pixels don't split into STRIPS equal segments");
+            const uint8_t base = port & ~mask;
+            const uint16_t length = N / STRIPS;
+            send_all(0UL, base); // start frame
+            for(uint16_t i = 0; i < length; i++) {
+                uint32_t words[STRIPS];
+                for(uint8_t s = 0; s < STRIPS; s++)
+                    words[s] = ((0xE0UL | brightness) << 24) | pixels[s * length + i].get_bgr();
+                uint8_t planes[32];
+                encode(words, planes);
+                send_planes(planes, base);
+            }
+            // end frame: at least half a clock per LED
+            for(uint16_t i = 0; i <= length / 64; i++)
+                send_all(0xFFFFFFFFUL, base);
+        }
+};
+
+#endif
@@ -1,5 +1,7 @@
 #ifndef PIN_H
 #define PIN_H
+#include <avr/io.h>
+#include <avr/interrupt.h>
 
 enum Direction {
     INPUT,
@@ -22,14 +24,23 @@ struct Pin {
         mode(d);
         set(0);
     }
+    // mode() and set() read, modify and write the whole register. interrupts are
+    // held off meanwhile, so an ISR changing another pin of the same port (SPI chip
+    // select, nRF CE) can't have its write undone
     void mode(Direction d) const {
+        const uint8_t sreg = SREG;
+        cli();
         ddr_reg() = (d == OUTPUT) ? ddr_reg() | _BV(pin) : ddr_reg() & ~_BV(pin);
+        SREG = sreg;
     }
 
     void set(bool value) const {
+        const uint8_t sreg = SREG;
+        cli();
         port = value ? 
             port | _BV(pin) :
             port &~_BV(pin);
+        SREG = sreg;
     }
     
     bool get() const {
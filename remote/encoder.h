@@ -10,8 +10,10 @@ class Encoder {
         EncoderCallback callback;
 
     public:
-        Encoder(EncoderCallback callback = 0): callback(callback), prev_state(3) {}
-        void update(uint8_t new_state); //runs callback if encoder state has changed
+        Encoder(EncoderCallback callback = 0): prev_state(3), callback(callback) {}
+        // runs callback if encoder state has changed (<new_state> = A << 1 | B),
+        // cheap enough to call from the pin change interrupt
+        void update(uint8_t new_state);
         void bind_callback(EncoderCallback cb);
 
 };
@@ -0,0 +1,156 @@
+//////////////////////////////
+// knob_link.h
+//
+// the remote's side of the remote protocol (../remote_protocol.h)
+// Copyright Aaron Schraner, 2018
+//
+// the encoder steps pending since the last packet go out as one KnobPacket once the
+// radio is free. a packet is resent unchanged (same seq) until it is acknowledged,
+// the ACK payload carries the base's status, packets carry KNOB_FIRST until one
+// was acknowledged after boot. after 3 failed attempts the next
+// channel is tried, until every channel was. many retransmissions ask the base for
+// a quieter channel (KNOB_RESCAN), the remote follows the base's announcement.
+//
+
+#ifndef KNOB_LINK_H
+#define KNOB_LINK_H
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "../nrf.h"
+#include "../remote_protocol.h"
+
+class KnobLink {
+    private:
+        static const uint8_t rescan_level = 32; // ask the base for a quieter channel above this
+        NRF& nrf;
+        KnobPacket knob;        // packet being sent, kept until it is acknowledged
+        bool in_flight;
+        bool first;             // nothing acknowledged since boot (KNOB_FIRST)
+        uint8_t failures;       // unacknowledged attempts since waking up
+        uint32_t since;         // micros() at the first step in <knob>
+        BaseStatus status;      // last state reported by the base (ACK payload)
+        uint8_t current;        // RF channel
+        uint8_t hops;           // channels tried while searching for the base
+        uint8_t retry_level;    // 8x the average retransmissions per packet (failures count 16)
+
+        // try the next channel after the base stopped answering.
+        // gives up (failures stays) once every channel was tried
+        void hop() {
+            if(hops > CHANNEL_MAX - CHANNEL_MIN)
+                return;
+            if(!hops)
+                nrf.config_retransmission(2, 1); // 3 attempts 500us apart per channel
+            hops++;
+            current = current >= CHANNEL_MAX || current < CHANNEL_MIN ? CHANNEL_MIN : current + 1;
+            nrf.set_freq(current);
+            failures = 0;
+        }
+
+    public:
+        KnobLink(NRF& nrf, uint8_t channel): nrf(nrf), in_flight(false), first(true), failures(0),
+            since(0), status(), current(channel), hops(0), retry_level(0) {
+            knob.type = REMOTE_KNOB;
+            knob.version = REMOTE_PROTOCOL_VERSION;
+            knob.seq = 0;
+            knob.delta = 0;
+            knob.timestamp = 0;
+            knob.latency = 0;
+            knob.flags = 0;
+        }
+
+        // completion of a packet sent by send() (from the send callback), <now> is micros()
+        void sent(bool success, uint8_t retransmits, uint32_t now) {
+            retry_level = retry_level - retry_level / 8 + (success ? retransmits : 16);
+            if(!success) {
+                if(++failures >= 3)
+                    hop();
+                return; // resent unchanged (same seq) by send()
+            }
+            if(hops) {
+                // found the base
+                nrf.config_retransmission(15, 4);
+                hops = 0;
+            }
+            const uint32_t latency = now - since;
+            knob.latency = latency > 0xFFFF ? 0xFFFF : latency;
+            in_flight = false;
+            first = false;
+
+            // the ACK payload with the base's state
+            while(nrf.available()) {
+                uint8_t packet[32];
+                uint8_t pipe;
+                const uint8_t length = nrf.read(packet, &pipe);
+                if(pipe == 0 && length == sizeof(BaseStatus) && packet[0] == REMOTE_STATUS)
+                    status = *(const BaseStatus*)packet;
+            }
+
+            // follow the base to its new channel
+            if((status.flags & STATUS_CHANNEL_CHANGE) && status.channel != current) {
+                current = status.channel;
+                nrf.set_freq(current);
+            }
+        }
+
+        // send <pending> steps (taken and cleared with interrupts off, the encoder
+        // interrupt adds to them) as one knob packet if the radio isn't busy with the
+        // previous one. <pending_since> is micros() at the first of them.
+        // returns true if a packet went to the radio
+        bool send(volatile int8_t& pending, volatile uint32_t& pending_since, NRF::SendCallback done) {
+            nrf.service();
+            if(nrf.tx_busy() || failures >= 3)
+                return false;
+            if(!in_flight) {
+                if(!pending)
+                    return false;
+                knob.seq++;
+                const uint8_t sreg = SREG;
+                cli();
+                knob.delta = pending;
+                since = pending_since;
+                pending = 0;
+                SREG = sreg;
+                knob.timestamp = since / 1000; // micros() to ms
+                knob.flags = first ? KNOB_FIRST : 0;
+                if(retry_level > rescan_level) {
+                    knob.flags |= KNOB_RESCAN;
+                    retry_level = 0;
+                }
+                in_flight = true;
+            }
+            return nrf.send_async((const uint8_t*)&knob, sizeof(knob), done);
+        }
+
+        // there is something to send (<pending> steps or an unacknowledged packet) and
+        // the base hasn't stopped answering, or the radio is still busy
+        bool due(int8_t pending) const {
+            return ((pending || in_flight) && failures < 3) || nrf.tx_busy();
+        }
+
+        // before powering down: the next wakeup tries again (on the home channel's
+        // retransmission settings if the base wasn't found)
+        void sleep() {
+            failures = 0;
+            if(hops) {
+                nrf.config_retransmission(15, 4);
+                hops = 0;
+            }
+        }
+
+        uint8_t channel() const {
+            return current;
+        }
+
+        // last state reported by the base
+        const BaseStatus& base_status() const {
+            return status;
+        }
+
+        // the packet being sent (or the last one)
+        const KnobPacket& packet() const {
+            return knob;
+        }
+};
+
+#endif
@@ -5,7 +5,10 @@
 
 #include "../pin.h"
 #include "../nrf.h"
+#include "../timer.h"
+#include "../remote_protocol.h"
 #include "encoder.h"
+#include "knob_link.h"
 
 // used pins:
 // PB0 - NRF CE
@@ -27,33 +30,52 @@ void pullup_unused_pins() {
 
 NRF* global_nrf = 0;
 Pin led(PORTB, 1, OUTPUT);
+Pin enc_a(PORTD, 6),
+    enc_b(PORTD, 7);
+
+// decoded in the pin change interrupt
+Encoder encoder;
+
+// encoder steps not sent to the base station yet (changed by the encoder interrupt)
+volatile int8_t pending_steps = 0;
+volatile uint32_t pending_since = 0; // micros() at the first of them
+
+// knob packets to the base station, created in main()
+KnobLink* global_link = 0;
+const uint8_t home_channel = 76;
+
+// encoder callback (from the pin change interrupt), one step per detent
 void change_volume(int8_t increment, uint8_t edge_id) {
     if(edge_id != 0)
         return;
-    uint8_t packet[1];
-    switch(increment) {
-        case 1:  packet[0] = '+'; break;
-        case -1: packet[0] = '-'; break;
-        default: packet[0] = '?'; break;
-    }
-    if(global_nrf)
-    {
+    if(!pending_steps)
+        pending_since = micros();
+    if(increment > 0 && pending_steps < 127)
+        pending_steps++;
+    else if(increment < 0 && pending_steps > -127)
+        pending_steps--;
+}
+
+void send_done(bool success, uint8_t retransmits) {
+    led = 0;
+    global_link->sent(success, retransmits, micros());
+}
+
+// send the pending steps as one knob packet if the radio isn't busy with the previous one
+void send_pending() {
+    if(global_link->send(pending_steps, pending_since, send_done))
         led = 1;
-        global_nrf->stop_listening();
-        global_nrf->send(packet, 1);
-        global_nrf->start_listening();
-        led = 0;
-    }
 }
 
-// rotary encoder ISR
-int knob_timer = 0;
+// rotary encoder ISR, decodes every edge (also wakes the MCU from power down)
+volatile uint8_t edges = 0;
 ISR(PCINT2_vect) {
-    // MCU re-enters sleep after this times out
-    knob_timer = 3000; // 3000 = approx. 2 seconds
-
+    encoder.update(enc_a << 1 | enc_b);
+    edges++;
 }
 
+// nRF IRQ (INT0), only wakes the MCU from idle so service() finishes the transmission
+EMPTY_INTERRUPT(INT0_vect);
 
 const uint8_t remote_address[6] = "2Node"; // remote address
 const uint8_t station_address[6] = "1Node"; // receiver address
@@ -64,27 +86,29 @@ int main() {
         nrf_ce (PORTB, 0, OUTPUT),
         nrf_cs (PORTB, 2, OUTPUT);
 
-    Pin enc_a(PORTD, 6),
-        enc_b(PORTD, 7);
-
-    Encoder encoder;
-
     NRF nrf(nrf_irq, nrf_ce, nrf_cs);
     global_nrf = &nrf;
+    KnobLink link(nrf, home_channel);
+    global_link = &link;
+
+    system_timer_init();
+    spi_init(true); // SCK = F_CPU/2
+    nrf.set_clock(micros);
 
     nrf.init();
-    nrf.set_freq(76);
+    nrf.set_freq(home_channel);
     nrf.set_tx_addr(station_address);
     nrf.setup_rx_pipe(1, remote_address, 1);
-    nrf.start_listening();
+    // dynamic payloads on pipe 0 to receive the base's ACK payloads.
+    // the remote only transmits, so the receiver stays off (saves ~13mA while awake)
+    nrf.enable_dynamic_payloads(_BV(DPL_P0));
     _delay_ms(100);
 
     // send a '?' command on boot (check if speaker-side encoder is in the right position)
     uint8_t packet[1] = {'?'};
     led = 1;
-    global_nrf->stop_listening();
+    sei(); // for micros()
     global_nrf->send(packet, 1);
-    global_nrf->start_listening();
     led = 0;
     _delay_ms(10);
 
@@ -93,33 +117,49 @@ int main() {
     PCIFR |= _BV(PCIE2);
     PCMSK2 |= _BV(PCINT22) | _BV(PCINT23);
 
+    // falling edge on the nRF IRQ pin (PD2 = INT0) ends idle sleep
+    EICRA = _BV(ISC01);
+    EIFR = _BV(INTF0);
+    EIMSK |= _BV(INT0);
+
     // encoder will change volume - change_volume() gets invoked from within encoder.update().
+    encoder.update(enc_a << 1 | enc_b); // current position, no step
     encoder.bind_callback(change_volume);
 
     // enable interrupts
     sei();
 
     while(1) {
-        // enter power-down state
+        // the radio powers up by itself when send_async() has a packet for it
+        send_pending();
+
+        cli();
+        const uint8_t edges_seen = edges;
+        if(link.due(pending_steps)) {
+            // waiting for the radio: idle until the next interrupt (timer0 ticks every ms)
+            set_sleep_mode(SLEEP_MODE_IDLE);
+            sleep_enable();
+            sei(); // the instruction after sei() still runs before any interrupt
+            sleep_cpu();
+            sleep_disable();
+            continue;
+        }
+        sei();
+
+        // nothing left to send (or the base wasn't found, the steps are kept for the
+        // next wakeup): power everything down until the next encoder edge
         nrf.power_down();
+        link.sleep(); // if the base wasn't found, search again next time
+        cli();
+        if(edges != edges_seen) { // an edge arrived meanwhile
+            sei();
+            continue;
+        }
         set_sleep_mode(SLEEP_MODE_PWR_DOWN);
         sleep_enable();
         sleep_bod_disable(); // disable brownout detector while asleep
-        //sei();
+        sei();
         sleep_cpu();
         sleep_disable();
-        //cli();
-
-        // power up NRF module
-        nrf.power_up();
-
-        // poll encoder and send packets to base station when knob is turned
-        while(knob_timer) {
-            encoder.update(enc_a << 1 | enc_b);
-            _delay_us(10);
-            knob_timer--;
-        }
     }
 }
-
-
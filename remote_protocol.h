@@ -0,0 +1,72 @@
+//////////////////////////////
+// remote_protocol.h
+//
+// packet formats between the remote (remote/main.cpp) and the base station
+// Copyright Aaron Schraner, 2018
+// 
+// the remote sends a KnobPacket with the encoder steps accumulated since its last
+// acknowledged packet. the base answers with a BaseStatus in the ACK payload, so the
+// remote learns the base's state without a separate round trip. both use dynamic
+// payload lengths. the status in an ACK is the one the base loaded after the
+// previous packet, so it lags the packet being acknowledged by one.
+//
+// the base ignores a packet with the seq of the last one it applied (a retransmission
+// whose ACK was lost). a remote that was reset starts over at seq 1, its packets carry
+// KNOB_FIRST until one is acknowledged, so the base applies them whatever seq it had.
+//
+// channel changes: the base surveys channels in the background (channel_survey.h).
+// a remote that sees many retransmissions sets KNOB_RESCAN, the base then announces 
+// the quietest channel in its ACK payload (STATUS_CHANNEL_CHANGE). the remote follows
+// as soon as it gets that ACK, the base once the packet it acknowledged has arrived. a remote that loses the base altogether searches CHANNEL_MIN to
+// CHANNEL_MAX for it.
+//
+// packet types are outside of ASCII, anything else is fed to the command parser 
+// (single-byte commands like '?' from older remotes keep working).
+//
+
+#ifndef REMOTE_PROTOCOL_H
+#define REMOTE_PROTOCOL_H
+#include <stdint.h>
+
+const uint8_t REMOTE_PROTOCOL_VERSION = 2;
+
+// channels used (2402-2480MHz, inside the 2.4GHz ISM band)
+const uint8_t CHANNEL_MIN = 2;
+const uint8_t CHANNEL_MAX = 80;
+
+enum RemotePacketType: uint8_t {
+    REMOTE_KNOB = 0x81,
+    REMOTE_STATUS = 0x82
+};
+
+// remote -> base
+struct KnobPacket {
+    uint8_t type;       // REMOTE_KNOB
+    uint8_t version;    // REMOTE_PROTOCOL_VERSION
+    uint8_t seq;        // a retransmission of an unacknowledged packet keeps its seq
+    int8_t delta;       // encoder steps (positive is clockwise)
+    uint16_t timestamp; // remote milliseconds at the first step in <delta> (awake time only:
+                        // timer0 stops in power down, the base times packets by arrival)
+    uint16_t latency;   // us from first step to ACK of the previous packet (0xFFFF if longer)
+    uint8_t flags;
+} __attribute__((packed));
+
+// KnobPacket flags
+#define KNOB_RESCAN 0x01 // too many retransmissions, move to a quieter channel
+#define KNOB_FIRST 0x02  // no packet was acknowledged since the remote booted
+
+// base -> remote (ACK payload)
+struct BaseStatus {
+    uint8_t type;       // REMOTE_STATUS
+    uint8_t version;
+    uint8_t seq;        // last knob packet the base applied
+    int16_t position;   // volume steps applied since the base booted
+    uint8_t flags;
+    uint8_t channel;    // RF channel (the next one with STATUS_CHANNEL_CHANGE)
+} __attribute__((packed));
+
+// BaseStatus flags
+#define STATUS_MOVABLE 0x01        // speaker-side encoder was in a usable position at the last check
+#define STATUS_CHANNEL_CHANGE 0x02 // the base is about to switch to <channel>
+
+#endif
@@ -0,0 +1,87 @@
+//////////////////////////////
+// render.h
+//
+// frame interpolation: refreshes the strip faster than the analysis produces frames
+// Copyright Aaron Schraner, 2018
+//
+// the analysis hands over each frame's intensities with push(). render() is called
+// from a timer at the refresh rate and colors the strip with the intensities linearly
+// interpolated (8-bit fixed point) from the previous frame to the newest one over the
+// measured frame period, so the strip moves smoothly at the cost of one frame of
+// latency. a frame arriving early starts from what is shown at that moment, so late
+// or early frames don't make the strip jump. all state is in the object: nothing is
+// allocated per frame and render() only uses a few locals.
+//
+
+#ifndef RENDER_H
+#define RENDER_H
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "led_strip.h"
+
+template <uint8_t N>
+class Renderer {
+    public:
+        static const uint16_t min_period = 10, max_period = 200; // ms between frames
+
+    private:
+        uint8_t previous[N], current[N]; // intensities of the last two frames
+        uint32_t frame_time;   // millis() of the newest frame
+        uint16_t period;       // measured ms between frames
+        uint32_t hold_until;   // millis() until which the strip is drawn as it is
+
+        // interpolation position at <now>, 0 (previous frame) to 256 (newest frame)
+        uint16_t position(uint32_t now) const {
+            const uint32_t elapsed = now - frame_time;
+            return elapsed >= period ? 256 : elapsed * 256 / period;
+        }
+
+        // intensity <i> at position <t>, the difference times <t> takes 17 bits (+-255 * 256)
+        uint8_t value(uint8_t i, uint16_t t) const {
+            return previous[i] + (((int16_t)current[i] - previous[i]) * (int32_t)t >> 8);
+        }
+
+    public:
+        Renderer(): previous(), current(), frame_time(0), period(25), hold_until(0) {}
+
+        // a new analysis frame (<values>: N intensities) at <now> (millis())
+        void push(const uint8_t* values, uint32_t now) {
+            const uint8_t sreg = SREG;
+            cli();
+            const uint16_t t = position(now);
+            for(uint8_t i = 0; i < N; i++) {
+                previous[i] = value(i, t);
+                current[i] = values[i];
+            }
+            const uint32_t elapsed = now - frame_time;
+            period = elapsed < min_period ? min_period : elapsed > max_period ? max_period :
+                (period * 3 + elapsed) / 4;
+            frame_time = now;
+            SREG = sreg;
+        }
+
+        // draw <strip> as it is (key feedback) instead of rendering until <until>
+        void hold(uint32_t until) {
+            const uint8_t sreg = SREG;
+            cli();
+            hold_until = until;
+            SREG = sreg;
+        }
+
+        // color <strip> for <now> with <color>(intensity, <threshold>), unless it is held
+        void render(uint32_t now, Color* strip, Color (*color)(uint8_t, uint8_t), uint8_t threshold) {
+            if((int32_t)(hold_until - now) > 0)
+                return;
+            const uint16_t t = position(now);
+            for(uint8_t i = 0; i < N; i++)
+                strip[i] = color(value(i, t), threshold);
+        }
+
+        // average ms between frames
+        uint16_t frame_period() const {
+            return period;
+        }
+};
+
+#endif
@@ -0,0 +1,136 @@
+//////////////////////////////
+// resolution.h
+//
+// analysis resolutions and the multi-resolution (long/short FFT) analyzer
+// Copyright Aaron Schraner, 2018
+//
+// the 128-point FFT at 2756Hz has 21.5Hz bins and a 46ms window: coarse for the bass,
+// slow for hi-hats. the multi-resolution analyzer runs two transforms through the same
+// fix_fft (and its Sinewave table), one per frame so no frame costs more than before:
+//  - long: 128 points of the signal decimated by 2 (Decimator), 10.8Hz bins and a
+//    93ms window, for the LEDs of the low octaves
+//  - short: the latest 64 samples at the full rate, 43Hz bins and a 23ms window, for
+//    the LEDs above, and for the onset detector
+// the bins are merged into one per-LED vector, long bins 1.. then short bins from the
+// first one above the last long bin's frequency (frequencies for 2756Hz sampling).
+// fix_fft scales by 1/n, so a sine gives the same magnitude in both transforms.
+//
+// the 256-point mode runs fix_fftr_mag(), the real FFT that needs no imaginary array,
+// in place over the 256 latest samples: 10.8Hz bins up to the full 1378Hz with a 93ms
+// window. spread_bins() gives the first half of the strip one bin each and shares the
+// rest of the bins among the second half.
+//
+
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+#include <stdint.h>
+
+// analysis resolutions (the "fft" parameter), for the mono layout
+enum Resolution: uint8_t {
+    RESOLUTION_128,  // one 128-point FFT per frame
+    RESOLUTION_MULTI, // long FFT for the bass, short FFT for the treble, on alternate frames
+    RESOLUTION_256   // one 256-point real FFT per frame
+};
+
+// <n> bins onto <count> LEDs: bins 1 to count / 2 on the first half of the strip, the
+// bins above shared evenly by the second half (each LED shows the loudest of its bins)
+inline void spread_bins(const uint8_t* bins, uint8_t n, uint8_t* leds, uint8_t count) {
+    const uint8_t half = count / 2, shared = n - 1 - half, rest = count - half;
+    for(uint8_t i = 0; i < half; i++)
+        leds[i] = bins[i + 1];
+    for(uint8_t i = 0; i < rest; i++) {
+        const uint8_t first = half + 1 + (uint16_t)i * shared / rest,
+                      end = half + 1 + (uint16_t)(i + 1) * shared / rest;
+        uint8_t loudest = 0;
+        for(uint8_t b = first; b < end; b++)
+            if(bins[b] > loudest)
+                loudest = bins[b];
+        leds[half + i] = loudest;
+    }
+}
+
+// decimation by 2 with a [1 3 3 1] / 8 lowpass: about -23dB at 1kHz (aliased onto the
+// long FFT's 378Hz), where averaged pairs only reach -8dB. cheap enough for the ADC ISR
+class Decimator {
+    private:
+        int8_t x1, x2, x3; // previous samples
+        bool odd;
+
+    public:
+        Decimator(): x1(0), x2(0), x3(0), odd(false) {}
+
+        // feed a sample, returns true with a decimated one in <out> on every other call
+        bool push(int8_t x, int8_t& out) {
+            const bool ready = odd;
+            if(ready)
+                out = (x + 3 * (x1 + x2) + x3) >> 3;
+            x3 = x2;
+            x2 = x1;
+            x1 = x;
+            odd = !odd;
+            return ready;
+        }
+};
+
+template <uint8_t LEDS>
+class MultiResolution {
+    public:
+        static const uint8_t long_log2 = 7, short_log2 = 6;
+        static const uint8_t short_bins = (1 << short_log2) / 2;
+        // LEDs showing long bins (from bin 1) and the first short bin on the LED after
+        // them. the long bins end at long_leds * f / 256, the short ones start at
+        // short_start * f / 64, so short_start = long_leds / 4 + 1 leaves no overlap.
+        static const uint8_t long_leds = (LEDS - short_bins + 1) * 4 / 3;
+        static const uint8_t short_start = long_leds / 4 + 1;
+        static_assert(LEDS > short_bins && long_leds < (1 << long_log2) / 2,
+                "strip too short or too long for the multi-resolution layout");
+
+    private:
+        uint8_t leds[LEDS];
+        bool next_long;
+
+        static uint8_t magnitude(char re, char im) {
+            return ((re < 0 ? -re : re) + (im < 0 ? -im : im)) / 2;
+        }
+
+    public:
+        MultiResolution(): leds(), next_long(true) {}
+
+        // whether the next frame runs the long transform
+        bool long_frame() const {
+            return next_long;
+        }
+
+        // log2 of the next frame's transform length
+        uint8_t log2_length() const {
+            return next_long ? long_log2 : short_log2;
+        }
+
+        // take the result of the frame's transform (<re>, <im>: fix_fft's output) into
+        // the LEDs it covers. after a short transform <spectrum> gets its bins spread
+        // over 2 * short_bins entries (21.5Hz apart, like the 128-point spectrum).
+        // returns true if <spectrum> was updated
+        bool update(const char* re, const char* im, uint8_t* spectrum) {
+            const bool was_long = next_long;
+            next_long = !next_long;
+            if(was_long) {
+                for(uint8_t i = 0; i < long_leds; i++)
+                    leds[i] = magnitude(re[i + 1], im[i + 1]);
+                return false;
+            }
+            for(uint8_t k = 0; k < short_bins; k++) {
+                const uint8_t value = magnitude(re[k], im[k]);
+                spectrum[2 * k] = spectrum[2 * k + 1] = value;
+                if(k >= short_start && long_leds + k - short_start < LEDS)
+                    leds[long_leds + k - short_start] = value;
+            }
+            return true;
+        }
+
+        // merged per-LED magnitudes
+        const uint8_t* bins() const {
+            return leds;
+        }
+};
+
+#endif
@@ -0,0 +1,173 @@
+//////////////////////////////
+// settings.h
+//
+// runtime-tunable analyzer settings and the table of named parameters
+// that the command protocol (command.h) can get and set
+// Copyright Aaron Schraner, 2018
+// 
+//
+#ifndef SETTINGS_H
+#define SETTINGS_H
+#include <stddef.h>
+#include <avr/pgmspace.h>
+#include "stream_defs.h"
+#include "broadcast.h"
+#include "onset.h"
+#include "stereo.h"
+#include "resolution.h"
+#include "effects.h"
+
+// ADC sample rate and downsample ratio
+// samples are taken at a frequency of (samplerate / downsample) hertz
+const int downsample = 16;
+#define samplerate 44100
+
+struct Settings {
+    uint8_t alpha;        // attack: weight of a rising bin's newest frame (out of 256)
+    uint8_t threshold;    // LED strip threshold
+    uint8_t brightness;   // global LED brightness (0-31)
+    uint8_t gain;         // ADC gain, 0 = 10x, 1 = 200x
+    uint16_t sample_rate; // ADC sample rate in Hz
+    uint8_t stream;       // enabled stream packet types (stream_defs.h)
+    uint8_t channel;      // nRF channel (2400 + channel MHz)
+    uint8_t mode;         // NodeMode (broadcast.h)
+    uint16_t step_rate;   // volume encoder phases per second
+    uint8_t accel;        // volume acceleration (acceleration.h), 0 = off
+    uint8_t accel_threshold; // input steps per second where acceleration starts
+    uint8_t accel_max;    // largest step multiplier
+    uint8_t beat;         // beat effects (BEAT_* in onset.h)
+    uint8_t onset_sensitivity; // onset threshold: median + mean * this / 16
+    uint8_t refractory;   // least time between onsets, in 25ms frames
+    uint8_t release;      // weight of a falling bin's newest frame (out of 256)
+    uint8_t floor_rise;   // noise floor rise per frame (1/16ths)
+    uint8_t peak_hold;    // frames to hold peaks (0 = no peak hold)
+    uint8_t peak_decay;   // peak fall per frame after the hold
+    uint8_t layout;       // StereoLayout (stereo.h), stereo samples both ADC channels
+    uint8_t resolution;   // Resolution (resolution.h) of the mono layout
+    uint16_t refresh;     // strip refreshes per second (render.h), 0 = one draw per frame
+    uint8_t effect;       // visualizer effect (EffectId, effects.h)
+} __attribute__((packed));
+
+// the settings are stored as they are in EEPROM (settings_store.h), packed so the host
+// tools see the AVR's layout. new fields go at the end
+static_assert(sizeof(Settings) == 26, "Settings layout changed, update the EEPROM record size");
+
+const Settings default_settings = {
+    192,                     // alpha
+    8,                       // threshold
+    4,                       // brightness
+    0,                       // gain
+    samplerate / downsample, // sample_rate
+#ifdef SPECTRUM_STREAM
+    STREAM_ALL_EN,           // stream
+#else
+    0,                       // stream
+#endif
+    76,                      // channel
+    NODE_STANDALONE,         // mode
+    500,                     // step_rate
+    8,                       // accel
+    8,                       // accel_threshold
+    8,                       // accel_max
+    BEAT_FLASH,              // beat
+    24,                      // onset_sensitivity
+    6,                       // refractory
+    48,                      // release
+    4,                       // floor_rise
+    0,                       // peak_hold
+    8,                       // peak_decay
+    LAYOUT_MONO,             // layout
+    RESOLUTION_128,          // resolution
+    100,                     // refresh
+    EFFECT_BARS              // effect
+};
+
+// named parameter, maps onto a field of Settings
+struct Parameter {
+    char name[8];
+    uint8_t offset; // offsetof(Settings, field)
+    uint8_t size;   // 1 or 2 bytes
+    uint16_t min, max;
+};
+
+// parameter ids (index into parameters[])
+enum ParameterId: uint8_t {
+    PARAM_ALPHA,
+    PARAM_THRESHOLD,
+    PARAM_BRIGHTNESS,
+    PARAM_GAIN,
+    PARAM_SAMPLE_RATE,
+    PARAM_STREAM,
+    PARAM_CHANNEL,
+    PARAM_MODE,
+    PARAM_STEP_RATE,
+    PARAM_ACCEL,
+    PARAM_ACCEL_THRESHOLD,
+    PARAM_ACCEL_MAX,
+    PARAM_BEAT,
+    PARAM_ONSET,
+    PARAM_REFRACTORY,
+    PARAM_RELEASE,
+    PARAM_FLOOR,
+    PARAM_HOLD,
+    PARAM_PEAK_DECAY,
+    PARAM_LAYOUT,
+    PARAM_RESOLUTION,
+    PARAM_REFRESH,
+    PARAM_EFFECT,
+    PARAM_COUNT
+};
+
+#define SETTING(field) offsetof(Settings, field), sizeof(Settings::field)
+const Parameter parameters[PARAM_COUNT] PROGMEM = {
+    { "alpha",  SETTING(alpha),       1, 255  },
+    { "thresh", SETTING(threshold),   0, 255  },
+    { "bright", SETTING(brightness),  0, 31   },
+    { "gain",   SETTING(gain),        0, 1    },
+    { "rate",   SETTING(sample_rate), 200, 8000 },
+    { "stream", SETTING(stream),      0, 255  },
+    { "chan",   SETTING(channel),     0, 125  },
+    { "mode",   SETTING(mode),        0, NODE_SLAVE },
+    { "vrate",  SETTING(step_rate),   62, 2000 },
+    { "accel",  SETTING(accel),       0, 255  },
+    { "accthr", SETTING(accel_threshold), 0, 255 },
+    { "accmax", SETTING(accel_max),   1, 16   },
+    { "beat",   SETTING(beat),        0, BEAT_FLASH | BEAT_PALETTE | BEAT_PULSE },
+    { "onset",  SETTING(onset_sensitivity), 0, 255 },
+    { "refrac", SETTING(refractory),  0, 255  },
+    { "release", SETTING(release),    1, 255  },
+    { "floor",  SETTING(floor_rise),  0, 255  },
+    { "hold",   SETTING(peak_hold),   0, 255  },
+    { "pdecay", SETTING(peak_decay),  1, 255  },
+    { "layout", SETTING(layout),      0, LAYOUT_MID_SIDE },
+    { "fft",    SETTING(resolution),  0, RESOLUTION_256 },
+    { "refresh", SETTING(refresh),    0, 1000 },
+    { "effect", SETTING(effect),      0, EFFECT_COUNT - 1 },
+};
+#undef SETTING
+
+// read a parameter's current value out of <settings>
+inline uint16_t get_parameter(const Settings& settings, uint8_t id) {
+    const uint8_t* field = reinterpret_cast<const uint8_t*>(&settings) + 
+        pgm_read_byte(&parameters[id].offset);
+    // 16-bit fields may be unaligned (packed), read them little-endian bytewise
+    return pgm_read_byte(&parameters[id].size) == 2 ? 
+        field[0] | field[1] << 8 : *field;
+}
+
+// store a parameter in <settings>, clamped to its range
+inline uint16_t set_parameter(Settings& settings, uint8_t id, uint16_t value) {
+    const uint16_t min = pgm_read_word(&parameters[id].min),
+                   max = pgm_read_word(&parameters[id].max);
+    value = value < min ? min : value > max ? max : value;
+    uint8_t* field = reinterpret_cast<uint8_t*>(&settings) + pgm_read_byte(&parameters[id].offset);
+    if(pgm_read_byte(&parameters[id].size) == 2) {
+        field[0] = value;
+        field[1] = value >> 8;
+    }
+    else
+        *field = value;
+    return value;
+}
+
+#endif
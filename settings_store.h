@@ -0,0 +1,173 @@
+//////////////////////////////
+// settings_store.h
+//
+// persists Settings in EEPROM
+// Copyright Aaron Schraner, 2018
+// 
+// records are written round-robin into a ring of fixed-size slots (wear leveling),
+// each one is
+//
+//   magic | version | sequence (16 bit) | length | Settings (length bytes) | crc (16 bit)
+//
+// the newest record with a valid CRC wins, so a write interrupted by a reset just
+// leaves the previous record in charge. records shorter than the current Settings
+// (written by older firmware) are loaded with defaults for the missing fields, fields
+// whose meaning changed since a record's version are reset to their defaults.
+//
+// writes are deferred until the settings have stopped changing for a while, then
+// written one byte per poll() whenever the EEPROM is ready, so nothing ever waits
+// for the ~3.4ms byte write.
+//
+
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+#include "eeprom.h"
+#include "crc.h"
+#include "settings.h"
+#include <string.h>
+
+const uint8_t SETTINGS_MAGIC = 0x5E;
+const uint8_t SETTINGS_VERSION = 2;    // bump if the meaning of existing fields changes
+                                       // (and reset them in load())
+
+const uint16_t SETTINGS_BASE = 0;      // EEPROM address of the first slot
+const uint8_t SETTINGS_SLOT_SIZE = 64; // bytes per slot
+const uint8_t SETTINGS_SLOTS = 16;     // slots in the ring
+const uint16_t SETTINGS_DELAY = 2000;  // ms without changes before a write starts
+
+struct SettingsHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t sequence;
+    uint8_t length;
+} __attribute__((packed));
+
+static_assert(sizeof(SettingsHeader) + sizeof(Settings) + 2 <= SETTINGS_SLOT_SIZE,
+        "Settings no longer fit in an EEPROM slot");
+static_assert(SETTINGS_BASE + SETTINGS_SLOTS * SETTINGS_SLOT_SIZE <= EEPROM_SIZE,
+        "settings ring doesn't fit in EEPROM");
+
+class SettingsStore {
+    private:
+        // the record being written, header followed by the settings and the crc
+        uint8_t record[sizeof(SettingsHeader) + sizeof(Settings) + 2];
+        int8_t slot;          // slot of the newest record (-1: none)
+        uint16_t sequence;    // sequence number of the newest record
+        int8_t write_index;   // next byte of record to write (-1: idle)
+        bool dirty;
+        uint16_t changed_at;  // time of the last change (ms, truncated)
+
+        static uint16_t slot_address(uint8_t s) {
+            return SETTINGS_BASE + s * SETTINGS_SLOT_SIZE;
+        }
+
+        // true if the newest record holds exactly <settings>
+        bool matches(const Settings& settings) const {
+            if(slot < 0)
+                return false;
+            const uint16_t address = slot_address(slot);
+            if(ee_read(address + offsetof(SettingsHeader, length)) != sizeof(Settings) ||
+                    ee_read(address + offsetof(SettingsHeader, version)) != SETTINGS_VERSION)
+                return false;
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(&settings);
+            for(uint8_t i=0; i<sizeof(Settings); i++)
+                if(ee_read(address + sizeof(SettingsHeader) + i) != data[i])
+                    return false;
+            return true;
+        }
+
+    public:
+        SettingsStore(): slot(-1), sequence(0), write_index(-1), 
+            dirty(false), changed_at(0) {}
+
+        // find the newest valid record and load it into <settings>
+        // (one pass over the ring), older versions are migrated. returns false
+        // and leaves <settings> untouched if there is none.
+        bool load(Settings& settings) {
+            int8_t best = -1;
+            for(uint8_t s=0; s<SETTINGS_SLOTS; s++) {
+                const uint16_t address = slot_address(s);
+                SettingsHeader header;
+                uint8_t* h = reinterpret_cast<uint8_t*>(&header);
+                uint16_t crc = CRC16_INIT;
+                for(uint8_t i=0; i<sizeof(header); i++)
+                    crc = crc16_update(crc, h[i] = ee_read(address + i));
+                if(header.magic != SETTINGS_MAGIC || !header.version ||
+                        header.version > SETTINGS_VERSION ||
+                        sizeof(header) + header.length + 2 > SETTINGS_SLOT_SIZE)
+                    continue;
+                for(uint8_t i=0; i<header.length; i++)
+                    crc = crc16_update(crc, ee_read(address + sizeof(header) + i));
+                const uint16_t address_crc = address + sizeof(header) + header.length;
+                if(crc != (ee_read(address_crc) | ee_read(address_crc + 1) << 8))
+                    continue;
+                // newest by serial number arithmetic, so the sequence can wrap
+                if(best < 0 || (int16_t)(header.sequence - sequence) > 0) {
+                    best = s;
+                    sequence = header.sequence;
+                }
+            }
+            slot = best;
+            if(best < 0)
+                return false;
+
+            const uint16_t address = slot_address(best);
+            uint8_t length = ee_read(address + offsetof(SettingsHeader, length));
+            if(length > sizeof(Settings))
+                length = sizeof(Settings);
+            uint8_t* data = reinterpret_cast<uint8_t*>(&settings);
+            for(uint8_t i=0; i<length; i++)
+                data[i] = ee_read(address + sizeof(SettingsHeader) + i);
+
+            // fields that changed meaning since the record was written
+            const uint8_t version = ee_read(address + offsetof(SettingsHeader, version));
+            if(version < 2)
+                settings.alpha = default_settings.alpha; // was the WMA weight of a new frame
+            return true;
+        }
+
+        // note that the settings changed, they will be written once they settle
+        void changed(uint16_t now) {
+            dirty = true;
+            changed_at = now;
+        }
+
+        // advance a pending write, call regularly (e.g. once per frame)
+        // <now> is the time in ms
+        void poll(const Settings& settings, uint16_t now) {
+            // (also keeps matches() from stalling on a write in progress)
+            if(!ee_ready())
+                return;
+
+            if(write_index < 0) {
+                if(!dirty || (uint16_t)(now - changed_at) < SETTINGS_DELAY)
+                    return;
+                dirty = false;
+
+                if(matches(settings))
+                    return; // changed back to what is already stored
+
+                // build the next record
+                SettingsHeader header = { SETTINGS_MAGIC, SETTINGS_VERSION, 
+                    (uint16_t)(sequence + 1), sizeof(Settings) };
+                memcpy(record, &header, sizeof(header));
+                memcpy(record + sizeof(header), &settings, sizeof(Settings));
+                const uint16_t crc = crc16(record, sizeof(header) + sizeof(Settings));
+                record[sizeof(record) - 2] = crc & 0xFF;
+                record[sizeof(record) - 1] = crc >> 8;
+                write_index = 0;
+            }
+
+            const uint8_t next = (slot + 1) % SETTINGS_SLOTS;
+            ee_write(slot_address(next) + write_index, record[write_index]);
+            if(++write_index == sizeof(record)) {
+                write_index = -1;
+                slot = next;
+                sequence++;
+            }
+        }
+
+        bool busy() const { return dirty || write_index >= 0; }
+};
+
+#endif
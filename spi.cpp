@@ -1,16 +1,23 @@
 #include "spi.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
 //////////////////////////////
 // spi.cpp
 //
-// driver for hardware SPI (only on ATMEGA2560 right now)
+// driver for hardware SPI (ATMEGA2560 and ATMEGA328)
 // Copyright Aaron Schraner, 2018
 // 
 
 #include "pin.h"
 #include <util/delay.h>
 
-void spi_init()
+// queued jobs, the head is the one on the bus
+static SPIJob* volatile queue_head = 0;
+static SPIJob* volatile queue_tail = 0;
+static volatile uint8_t position = 0; // byte of the head job being exchanged
+static volatile bool polled = false;  // the head job is clocked by spi_wait(), SPIE is off
+
+void spi_init(bool fast)
 {
 #if defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
     const Pin 
@@ -24,19 +31,118 @@ void spi_init()
         MOSI(PORTB, 2, OUTPUT),
         MISO(PORTB, 3, INPUT),
         _SS(PORTB,  0, OUTPUT); // if _SS is not configured as an output, SPI does not work
+#else
+#error "SPI pins unknown for this MCU"
 #endif
     _SS = 1;
 
-	//enable the SPI module
-	SPCR = _BV(SPE) | _BV(MSTR); // | _BV(SPI2X);
+	//enable the SPI module and its interrupt
+	SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPIE);
+    if(fast)
+        SPSR |= _BV(SPI2X);
+    else
+        SPSR &= ~_BV(SPI2X);
+}
+
+static void start(SPIJob* job) {
+    position = 0;
+    if(job->cs)
+        spi_select(*job->cs);
+    SPDR = job->tx ? job->tx[0] : 0;
+}
+
+// a byte of the head job has been exchanged
+static void step() {
+    SPIJob* job = queue_head;
+    const uint8_t data = SPDR;
+    if(!job)
+        return;
+    if(job->rx)
+        job->rx[position] = data;
+    if(++position < job->length) {
+        SPDR = job->tx ? job->tx[position] : 0;
+        return;
+    }
+
+    if(job->cs)
+        spi_deselect(*job->cs);
+    if(polled) {
+        polled = false;
+        SPCR |= _BV(SPIE); // jobs queued meanwhile run from the interrupt
+    }
+    queue_head = job->next;
+    if(!queue_head)
+        queue_tail = 0;
+    job->done = true;
+    if(job->callback)
+        job->callback(job->context);
+    if(queue_head)
+        start(queue_head);
+}
+
+ISR(SPI_STC_vect) {
+    step();
+}
+
+void spi_queue(SPIJob& job) {
+    job.next = 0;
+    if(!job.length) {
+        job.done = true;
+        if(job.callback)
+            job.callback(job.context);
+        return;
+    }
+    job.done = false;
+    const uint8_t sreg = SREG;
+    cli();
+    if(queue_tail) {
+        queue_tail->next = &job;
+        queue_tail = &job;
+    }
+    else {
+        queue_head = queue_tail = &job;
+        start(&job);
+    }
+    SREG = sreg;
+}
+
+void spi_wait(SPIJob& job) {
+    while(!job.done) {
+        // a polled job, or no interrupts (called from an ISR or with cli()): poll SPIF.
+        // reading SPSR and then SPDR in step() clears the flag
+        const uint8_t sreg = SREG;
+        cli();
+        if((polled || !(sreg & _BV(SREG_I))) && (SPSR & _BV(SPIF)))
+            step();
+        SREG = sreg;
+    }
+}
+
+// the caller waits anyway, so on an idle bus the job is clocked by polling: a byte
+// takes 16 cycles at SCK = F_CPU/2, less than entering and leaving SPI_STC_vect.
+// jobs queued meanwhile (from an ISR) wait behind it as usual
+void spi_transfer(const Pin& cs, const uint8_t* tx, uint8_t* rx, uint8_t length) {
+    SPIJob job = { &cs, tx, rx, length, 0, 0, false, 0 };
+    const uint8_t sreg = SREG;
+    cli();
+    if(!queue_head && length) {
+        SPCR &= ~_BV(SPIE);
+        polled = true;
+        queue_head = queue_tail = &job;
+        start(&job);
+    }
+    else
+        spi_queue(job);
+    SREG = sreg;
+    spi_wait(job);
 }
 
 // send <data>, MSB first
 // return SPI input data
 uint8_t spi_send(uint8_t data)
 {
-	SPDR = data;
-	while(!(SPSR & _BV(SPIF)));
-	return SPDR;
+    SPIJob job = { 0, &data, &data, 1, 0, 0, false, 0 };
+    spi_queue(job);
+    spi_wait(job);
+    return data;
 }
-
@@ -1,12 +1,67 @@
 #ifndef SPI_H
 #define SPI_H
 #include <stdint.h>
+#include <avr/io.h>
+#include "pin.h"
 
-void spi_init();
+//////////////////////////////
+// spi.h
+//
+// interrupt driven SPI master with a queue of transactions
+// Copyright Aaron Schraner, 2018
+// 
+// a job selects its device, exchanges <length> bytes and deselects it again, all
+// from the SPI_STC interrupt, so the main loop keeps running meanwhile. jobs run in
+// the order they were queued. spi_transfer() is the blocking version, it polls SPIF
+// when the bus is idle (at SCK = F_CPU/2 a byte is over before an interrupt per byte
+// would pay off). waiting with interrupts disabled (inside an ISR) drives the
+// transfer by polling too. background jobs (spi_queue()) pay about 40 cycles of
+// interrupt overhead per byte, for a main loop that keeps running during the job.
+
+struct SPIJob {
+    const Pin* cs;           // chip select, 0 if the caller handles it
+    const uint8_t* tx;       // bytes to send, zeros if 0
+    uint8_t* rx;             // received bytes, discarded if 0 (may be the same as tx)
+    uint8_t length;
+    void (*callback)(void* context); // run from the interrupt when done (optional)
+    void* context;
+    volatile bool done;
+    SPIJob* volatile next;   // queue link
+};
+
+// <fast> doubles the SPI clock (SPI2X, F_CPU/2 instead of F_CPU/4)
+void spi_init(bool fast = false);
+
+// start <job> in the background, it must stay valid until job.done
+void spi_queue(SPIJob& job);
+
+// wait until <job> is done
+void spi_wait(SPIJob& job);
+
+// exchange <length> bytes with the device on <cs> and wait for it
+void spi_transfer(const Pin& cs, const uint8_t* tx, uint8_t* rx, uint8_t length);
+
+// send <data> without touching any chip select, return the byte received
 uint8_t spi_send(uint8_t data);
+
 // read one byte via SPI
 inline uint8_t spi_read() {
     return spi_send(0x00);
 }
 
+// start and end a transaction with the device on chip select <cs>
+// (host builds implement these in host/nrf_sim.cpp, so the emulated radio sees
+// where commands begin and end)
+#ifdef __AVR__
+inline void spi_select(const Pin& cs) {
+    cs = 0;
+}
+inline void spi_deselect(const Pin& cs) {
+    cs = 1;
+}
+#else
+void spi_select(const Pin& cs);
+void spi_deselect(const Pin& cs);
+#endif
+
 #endif
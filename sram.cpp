@@ -0,0 +1,57 @@
+//////////////////////////////
+// sram.cpp
+//
+// stack painting and SRAM statistics (sram.h)
+// Copyright Aaron Schraner, 2018
+//
+
+#include "sram.h"
+#include <avr/io.h>
+
+extern uint8_t __data_start, __data_end, __bss_start, __bss_end;
+extern uint8_t __heap_start, __stack;
+extern uint8_t* __brkval; // top of the heap, 0 before the first allocation
+
+// paint the memory from the end of the globals up to RAMEND. this runs in .init1,
+// before the stack pointer and r1 are set up, so it can't be C
+void sram_paint_stack() __attribute__((naked, used, section(".init1")));
+void sram_paint_stack() {
+    __asm__ volatile(
+        "    ldi r30, lo8(__heap_start)\n"
+        "    ldi r31, hi8(__heap_start)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (sram_paint));
+}
+
+static uint8_t* heap_top() {
+    return __brkval ? __brkval : &__heap_start;
+}
+
+uint16_t sram_free() {
+    uint8_t top;
+    return &top - heap_top();
+}
+
+uint16_t sram_unused() {
+    const uint8_t* p = heap_top();
+    const uint8_t* const end = &__stack;
+    while(p <= end && *p == sram_paint)
+        p++;
+    return p - heap_top();
+}
+
+void sram_stats(SramStats& stats) {
+    stats.data = &__data_end - &__data_start;
+    stats.bss = &__bss_end - &__bss_start;
+    stats.heap = heap_top() - &__heap_start;
+    stats.unused = sram_unused();
+    stats.stack_max = &__stack - heap_top() + 1 - stats.unused;
+    stats.free_now = sram_free();
+}
@@ -0,0 +1,37 @@
+//////////////////////////////
+// sram.h
+//
+// SRAM instrumentation: stack painting, stack high-water mark, heap and free memory
+// Copyright Aaron Schraner, 2018
+//
+// memory from the end of the globals (.data, .bss) up: the heap (vector.h's new)
+// grows upwards from __heap_start to __brkval, the stack downwards from RAMEND.
+// everything between them is painted with sram_paint before main() (.init1), so the
+// painted bytes left between the heap and the deepest the stack ever went show how
+// close they came. `make sram` lists the globals per module from the linker map.
+//
+
+#ifndef SRAM_H
+#define SRAM_H
+#include <stdint.h>
+
+const uint8_t sram_paint = 0xC5;
+
+struct SramStats {
+    uint16_t data, bss;  // static: initialized and zeroed globals
+    uint16_t heap;       // allocated so far (vector.h)
+    uint16_t stack_max;  // deepest stack since boot
+    uint16_t free_now;   // between the heap and the stack pointer
+    uint16_t unused;     // painted bytes left: free memory at the stack's deepest
+};
+
+// bytes between the top of the heap (or the globals) and the stack pointer
+uint16_t sram_free();
+
+// painted bytes above the heap that no stack ever reached (low-water free memory).
+// scans up to a few KB, call it now and then rather than every frame
+uint16_t sram_unused();
+
+void sram_stats(SramStats& stats);
+
+#endif
@@ -0,0 +1,58 @@
+//////////////////////////////
+// stereo.h
+//
+// per-channel spectra of two real signals from one complex FFT, and their strip layouts
+// Copyright Aaron Schraner, 2018
+//
+// the left samples go into the real part, the right samples into the imaginary part
+// (the mono analyzer leaves it zero), and one 128-point fix_fft transforms both. since
+// the spectrum of a real signal is conjugate symmetric, bin k of each channel is
+//   L[k] = (Z[k] + conj(Z[N-k])) / 2
+//   R[k] = (Z[k] - conj(Z[N-k])) / 2j
+// so stereo costs a 64 step split loop on top of the mono analysis, not a second FFT.
+// for mid/side, mid = (L+R)/2 and side = (L-R)/2 are transformed the same way.
+//
+
+#ifndef STEREO_H
+#define STEREO_H
+#include <stdint.h>
+
+// channel layouts (the "layout" parameter)
+enum StereoLayout: uint8_t {
+    LAYOUT_MONO,     // one channel, one spectrum along the strip
+    LAYOUT_MIRROR,   // left spectrum mirrored on the first half, right on the second (bass in the middle)
+    LAYOUT_MID_SIDE  // mid (L+R) spectrum on the first half, side (L-R) on the second
+};
+
+// magnitudes of bin <k> of the two signals transformed together by an <n> point FFT
+// (<re>, <im>: fix_fft's output), approximated as abs(real)/2 + abs(imag)/2 like mono
+inline void stereo_split(const char* re, const char* im, uint8_t n, uint8_t k,
+        uint8_t& first, uint8_t& second) {
+    const uint8_t mirror = (n - k) & (n - 1);
+    const int16_t a = re[k], b = im[k], c = re[mirror], d = im[mirror];
+    const int16_t first_re = a + c, first_im = b - d,   // 2 * L[k]
+                  second_re = b + d, second_im = c - a; // 2 * R[k]
+    first = ((first_re < 0 ? -first_re : first_re) + (first_im < 0 ? -first_im : first_im)) / 4;
+    second = ((second_re < 0 ? -second_re : second_re) + (second_im < 0 ? -second_im : second_im)) / 4;
+}
+
+// lay out both spectra on <count> LEDs: the first signal (left or mid) on the first
+// half, the second (right or side) on the second half, bins 1 and up (DC, which also
+// carries the ADC's offset, is left out). <mono> gets the
+// n / 2 bins of the sum (mid) spectrum for the onset detector and the stream.
+inline void stereo_bins(const char* re, const char* im, uint8_t n, uint8_t layout,
+        uint8_t* leds, uint8_t count, uint8_t* mono) {
+    const uint8_t half = count / 2;
+    for(uint8_t k = 0; k < n / 2; k++) {
+        uint8_t first, second;
+        stereo_split(re, im, n, k, first, second);
+        mono[k] = layout == LAYOUT_MID_SIDE ? first : (first + second) / 2;
+        if(k < 1 || k > half)
+            continue;
+        leds[layout == LAYOUT_MIRROR ? half - k : k - 1] = first;
+        if(half + k - 1 < count)
+            leds[half + k - 1] = second;
+    }
+}
+
+#endif
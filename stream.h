@@ -0,0 +1,105 @@
+//////////////////////////////
+// stream.h
+//
+// binary spectrum stream: sends samples, FFT bins and strip colors as framed packets
+// (format in stream_defs.h, decoded on the host by host/capture.cpp)
+// Copyright Aaron Schraner, 2018
+// 
+// a packet is only queued if it fits into the USART tx buffer as a whole, otherwise it
+// is dropped and counted, so streaming never stalls the analysis loop.
+//
+
+#ifndef STREAM_H
+#define STREAM_H
+#include "crc.h"
+#include "stream_defs.h"
+#include "led_strip.h"
+
+template <typename Output>
+class SpectrumStream {
+    private:
+        Output& out;
+        uint8_t mask;     // enabled packet types (STREAM_*_EN)
+        uint16_t seq;     // sequence number of the next packet
+        uint16_t dropped; // packets dropped for lack of buffer space
+        uint16_t crc;
+
+        void put(uint8_t value) {
+            out.write(value);
+            crc = crc16_update(crc, value);
+        }
+
+        void put16(uint16_t value) {
+            put(value & 0xFF);
+            put(value >> 8);
+        }
+
+        // write sync and header, returns false (and counts a drop) if the packet won't fit
+        bool begin(StreamPacketType type, uint16_t length) {
+            if(!(mask & _BV(type)))
+                return false;
+            if(out.tx_free() < STREAM_HEADER_LENGTH + length + STREAM_CRC_LENGTH) {
+                dropped++;
+                seq++;
+                return false;
+            }
+            out.write(STREAM_SYNC0);
+            out.write(STREAM_SYNC1);
+            crc = CRC16_INIT;
+            put(type);
+            put16(seq++);
+            put16(length);
+            return true;
+        }
+
+        void end() {
+            const uint16_t c = crc;
+            out.write(c & 0xFF);
+            out.write(c >> 8);
+        }
+
+    public:
+        SpectrumStream(Output& out, uint8_t mask = 0):
+            out(out), mask(mask), seq(0), dropped(0), crc(CRC16_INIT) {}
+
+        void enable(uint8_t new_mask) { mask = new_mask; }
+        uint8_t enabled() const { return mask; }
+        uint16_t dropped_packets() const { return dropped; }
+
+        // send a packet with an arbitrary payload
+        bool send(StreamPacketType type, const uint8_t* data, uint16_t length) {
+            if(!begin(type, length))
+                return false;
+            for(uint16_t i=0; i<length; i++)
+                put(data[i]);
+            end();
+            return true;
+        }
+
+        bool send_samples(const char* samples, int length) {
+            return send(STREAM_SAMPLES, reinterpret_cast<const uint8_t*>(samples), length);
+        }
+
+        bool send_bins(const uint8_t* bins, int length) {
+            return send(STREAM_BINS, bins, length);
+        }
+
+        bool send_colors(const Color* strip, int length) {
+            if(!begin(STREAM_COLORS, length * 3))
+                return false;
+            for(int i=0; i<length; i++) {
+                put(strip[i].r);
+                put(strip[i].g);
+                put(strip[i].b);
+            }
+            end();
+            return true;
+        }
+
+        bool send_status(uint16_t frame) {
+            StreamStatus status = { dropped, out.dropped(), frame };
+            return send(STREAM_STATUS, reinterpret_cast<const uint8_t*>(&status), sizeof(status));
+        }
+};
+
+#endif
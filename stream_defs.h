@@ -0,0 +1,48 @@
+//////////////////////////////
+// stream_defs.h
+//
+// packet format of the binary spectrum stream (see stream.h and host/capture.cpp)
+// Copyright Aaron Schraner, 2018
+// 
+// every packet is framed as
+//
+//   0xA5 0x5A | type | seq (16 bit) | length (16 bit) | payload (length bytes) | crc (16 bit)
+//
+// multi-byte fields are little-endian. seq increments for every packet the firmware
+// tries to send (including the ones it drops), so gaps in seq are lost packets.
+// crc is CRC-16/CCITT (crc.h) over type, seq, length and payload.
+//
+
+#ifndef STREAM_DEFS_H
+#define STREAM_DEFS_H
+#include <stdint.h>
+
+const uint8_t STREAM_SYNC0 = 0xA5;
+const uint8_t STREAM_SYNC1 = 0x5A;
+
+const int STREAM_HEADER_LENGTH = 7; // sync, type, seq, length
+const int STREAM_CRC_LENGTH = 2;
+const int STREAM_MAX_PAYLOAD = 512;
+
+enum StreamPacketType: uint8_t {
+    STREAM_SAMPLES = 1, // raw 8-bit ADC samples of one analysis frame
+    STREAM_BINS = 2,    // 8-bit FFT magnitudes, starting at bin 0
+    STREAM_COLORS = 3,  // r, g, b for every LED on the strip
+    STREAM_STATUS = 4   // StreamStatus
+};
+
+// bits of the stream enable mask
+#define STREAM_SAMPLES_EN (1 << STREAM_SAMPLES)
+#define STREAM_BINS_EN    (1 << STREAM_BINS)
+#define STREAM_COLORS_EN  (1 << STREAM_COLORS)
+#define STREAM_STATUS_EN  (1 << STREAM_STATUS)
+#define STREAM_ALL_EN     (STREAM_SAMPLES_EN | STREAM_BINS_EN | STREAM_COLORS_EN | STREAM_STATUS_EN)
+
+// payload of a STREAM_STATUS packet, sent periodically
+struct StreamStatus {
+    uint16_t dropped_packets; // packets dropped because the USART tx buffer was full
+    uint16_t dropped_bytes;   // bytes the USART dropped (debug output included)
+    uint16_t frame;           // analysis frame counter
+} __attribute__((packed));
+
+#endif
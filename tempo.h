@@ -0,0 +1,231 @@
+//////////////////////////////
+// tempo.h
+//
+// tempo (BPM) tracker with a phase-locked beat clock
+// Copyright Aaron Schraner, 2018
+//
+// every frame's onset strength (onset.h flux) goes into a ring of the last 128 frames
+// (about 3 seconds). the autocorrelation of that envelope is computed for one lag per
+// frame, so a sweep over all lags spreads over 60 frames and no frame pays more than
+// 128 multiply-adds. after each sweep the peak with the best score (plus half the
+// score at twice the lag, which favours the beat over its subdivisions) becomes the
+// beat period, converted to milliseconds with the measured frame period. frames
+// come every 25ms, or every 50ms in multi-resolution mode (short frames only), so
+// a beat's peak may spread over a few lags: peaks are scored with their neighbours
+// and a strong one at half the lag of the best is taken as the beat.
+//
+// the beat clock runs on time rather than frames: phase(now) can be read at any
+// moment, by any effect. detected onsets pull the phase towards 0 (proportional
+// correction) and nudge the period, so the clock stays locked between sweeps.
+//
+
+#ifndef TEMPO_H
+#define TEMPO_H
+#include <stdint.h>
+
+class TempoTracker {
+    public:
+        static const uint8_t length = 128; // envelope frames
+        static const uint8_t min_lag = 5, max_lag = 64; // frames (200 BPM at 50ms frames is 6)
+        static const uint16_t min_period = 300, max_period = 1000; // ms (200-60 BPM)
+
+    private:
+        uint8_t envelope[length];   // onset strength per frame
+        uint8_t head;               // next envelope entry to write
+        uint16_t mean;              // running mean of the envelope (x256)
+        int16_t score[max_lag - min_lag + 1]; // smoothed autocorrelation per lag
+        uint8_t next_lag;
+        uint8_t frames;             // frames seen, up to length
+
+        uint16_t frame_period;      // average frame period (ms x16)
+        uint32_t last_frame;        // millis() of the previous frame
+
+        uint16_t period;            // beat period in ms (0: no tempo yet)
+        uint16_t beat_phase;        // 0-65535 is one beat, at phase_time
+        uint32_t phase_time;
+        uint16_t beat_count;
+        uint8_t lock;               // confidence, 0-255
+
+        // envelope entry <age> frames ago, minus the mean
+        int16_t centered(uint8_t age) const {
+            return envelope[(uint8_t)(head - 1 - age) % length] - (mean >> 8);
+        }
+
+        // autocorrelation of the envelope at <lag> frames, per frame pair
+        int16_t correlate(uint8_t lag) const {
+            int32_t sum = 0;
+            for(uint8_t i = 0; i + lag < length; i++)
+                sum += (int32_t)centered(i) * centered(i + lag); // up to 255 * 255, past 16 bits
+            sum /= length - lag;
+            return sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+        }
+
+        int16_t lag_score(uint8_t lag) const {
+            return lag >= min_lag && lag <= max_lag ? score[lag - min_lag] : 0;
+        }
+
+        // score around <lag>: a period between two lags, or coarse frames, spread
+        // its peak over the neighbouring lags
+        int32_t peak_score(uint8_t lag) const {
+            return (int32_t)lag_score(lag - 1) + lag_score(lag) + lag_score(lag + 1);
+        }
+
+        // whether <lag> is a local maximum of the score within the tempo range
+        bool candidate(uint8_t lag) const {
+            const uint32_t ms = (uint32_t)lag * frame_period / 16;
+            return ms >= min_period && ms <= max_period &&
+                lag_score(lag) >= lag_score(lag - 1) && lag_score(lag) >= lag_score(lag + 1);
+        }
+
+        // pick the period after a sweep over all lags
+        void choose_period() {
+            int32_t best = 0;
+            uint8_t best_lag = 0;
+            for(uint8_t lag = min_lag; lag <= max_lag; lag++) {
+                if(!candidate(lag))
+                    continue;
+                const int32_t s = peak_score(lag) + peak_score(2 * lag) / 2;
+                if(s > best) {
+                    best = s;
+                    best_lag = lag;
+                }
+            }
+            if(!best_lag) {
+                lock = lock > 32 ? lock - 32 : 0;
+                return;
+            }
+            // a strong peak at half the lag is the beat: coarse frames (multi-resolution)
+            // blur the beat's peak over more lags than the one at two beats
+            const int32_t whole = peak_score(best_lag);
+            for(uint8_t lag = best_lag / 2 - 1; lag <= (best_lag + 1) / 2 + 1; lag++)
+                if(candidate(lag) && peak_score(lag) > whole * 3 / 4) {
+                    best_lag = lag;
+                    break;
+                }
+            // parabolic interpolation between the neighbouring lags (in 1/16 frames)
+            int32_t lag16 = best_lag * 16;
+            if(best_lag > min_lag && best_lag < max_lag) {
+                const int32_t a = lag_score(best_lag - 1), b = lag_score(best_lag),
+                              c = lag_score(best_lag + 1);
+                const int32_t denominator = a - 2 * b + c;
+                if(denominator < 0)
+                    lag16 += 8 * (a - c) / denominator;
+            }
+            const uint16_t new_period = lag16 * frame_period / 256;
+            // a close period refines the current one, a different one takes over
+            if(period && new_period > period - period / 8 && new_period < period + period / 8) {
+                period = (period * 3 + new_period) / 4;
+                lock = lock > 255 - 32 ? 255 : lock + 32;
+            }
+            else {
+                period = new_period;
+                lock = 64;
+            }
+        }
+
+        // advance the phase to <now>
+        void advance(uint32_t now) {
+            if(!period) {
+                phase_time = now;
+                return;
+            }
+            const uint32_t elapsed = now - phase_time;
+            const uint32_t total = beat_phase + elapsed * 65536 / period;
+            beat_count += total >> 16;
+            beat_phase = total;
+            phase_time = now;
+        }
+
+        // phase at <now> relative to the start of the current beat (x65536)
+        int32_t total_phase(uint32_t now) const {
+            if(!period)
+                return 0;
+            int32_t elapsed = now - phase_time;
+            if(elapsed > 16000) // no frames for a while
+                elapsed = 16000;
+            return beat_phase + elapsed * 65536 / period;
+        }
+
+    public:
+        TempoTracker(): envelope(), head(0), mean(0), score(), next_lag(min_lag), frames(0),
+            frame_period(25 * 16), last_frame(0), period(0), beat_phase(0), phase_time(0),
+            beat_count(0), lock(0) {}
+
+        // feed one frame: <strength> is the onset strength (flux), <onset> whether
+        // the onset detector fired, <now> is millis()
+        void update(uint16_t strength, bool onset, uint32_t now) {
+            // frame period, averaged
+            if(last_frame) {
+                const uint32_t elapsed = now - last_frame;
+                if(elapsed < 200)
+                    frame_period = frame_period - frame_period / 16 + elapsed;
+            }
+            last_frame = now;
+
+            // envelope
+            const uint8_t value = strength > 255 ? 255 : strength;
+            envelope[head] = value;
+            head = (head + 1) % length;
+            mean = mean - (mean >> 6) + ((uint16_t)value << 2);
+            if(frames < length)
+                frames++;
+
+            // one lag per frame, once the envelope is full
+            if(frames == length) {
+                int16_t& s = score[next_lag - min_lag];
+                s = s - s / 4 + correlate(next_lag) / 4;
+                if(++next_lag > max_lag) {
+                    next_lag = min_lag;
+                    choose_period();
+                }
+            }
+
+            // beat clock: pull the phase towards the onset
+            advance(now);
+            if(onset && period) {
+                // the onset happened about half a frame before it was detected
+                const int16_t error = total_phase(now - frame_period / 32); // signed: before or after the beat
+                beat_phase -= error / 4;
+                // the onset came late (error > 0): the beat is a little longer
+                const int32_t adjust = (int32_t)error * period / (65536L * 32);
+                period += adjust;
+                if(period < min_period)
+                    period = min_period;
+                else if(period > max_period)
+                    period = max_period;
+            }
+        }
+
+        // beats per minute (0: no tempo yet)
+        uint8_t bpm() const {
+            return period ? 60000UL / period : 0;
+        }
+
+        // beat period in ms (0: no tempo yet)
+        uint16_t beat_period() const {
+            return period;
+        }
+
+        // position within the beat at <now> (millis(), may be shortly before the last
+        // frame), 0 on the beat, 255 just before the next one
+        uint8_t phase(uint32_t now) const {
+            return total_phase(now) >> 8;
+        }
+
+        // beats counted so far (wraps), for effects that step once per beat
+        uint16_t beats(uint32_t now) const {
+            return beat_count + (total_phase(now) >> 16);
+        }
+
+        // measured frame period in ms x16
+        uint16_t frame_time() const {
+            return frame_period;
+        }
+
+        // how consistently the tempo was found in recent sweeps (0-255)
+        uint8_t confidence() const {
+            return lock;
+        }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "timer.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 void sample_timer_init(int sample_rate) {
     // set sample period 
@@ -22,7 +23,7 @@ void sample_timer_init(int sample_rate) {
     else 
         prescale = 256;
 
-    ICR1 = F_CPU / (sample_rate * 2 * prescale); // set output frequency
+    ICR1 = F_CPU / ((uint32_t)sample_rate * 2 * prescale); // set output frequency (stereo runs up to 32kHz)
     
 
 
@@ -41,4 +42,81 @@ void sample_timer_init(int sample_rate) {
 
 }
 
+volatile uint32_t system_milliseconds = 0;
 
+ISR(TIMER0_COMPA_vect) {
+    system_milliseconds++;
+}
+
+void system_timer_init() {
+    // CTC mode, interrupt once per millisecond
+    TCCR0A = _BV(WGM01);
+#if F_CPU >= 8000000UL
+    TCCR0B = _BV(CS01) | _BV(CS00); // prescale 64
+    OCR0A = F_CPU / 64 / 1000 - 1;
+#else
+    TCCR0B = _BV(CS01);             // prescale 8
+    OCR0A = F_CPU / 8 / 1000 - 1;
+#endif
+    TIMSK0 |= _BV(OCIE0A);
+}
+
+uint32_t millis() {
+    // 32-bit read must not be interrupted by the timer
+    const uint8_t sreg = SREG;
+    cli();
+    const uint32_t ms = system_milliseconds;
+    SREG = sreg;
+    return ms;
+}
+
+uint32_t micros() {
+    const uint8_t sreg = SREG;
+    cli();
+    uint32_t ms = system_milliseconds;
+    uint8_t ticks = TCNT0;
+    // compare match not serviced yet (counter already wrapped)
+    if((TIFR0 & _BV(OCF0A)) && ticks < OCR0A)
+        ms++;
+    SREG = sreg;
+    return ms * 1000 + (uint32_t)ticks * 1000 / (OCR0A + 1);
+}
+
+void step_timer_init(uint16_t rate) {
+    // CTC mode, prescale 1024
+    if(rate < 62)
+        rate = 62;
+    else if(rate > 2000)
+        rate = 2000;
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);
+    OCR2A = F_CPU / 1024 / rate - 1;
+    TIMSK2 |= _BV(OCIE2A);
+}
+
+void render_timer_init(uint16_t rate) {
+#if defined(__AVR_ATmega2560__)
+    if(!rate) {
+        TIMSK3 &= ~_BV(OCIE3A);
+        return;
+    }
+    if(rate < 25)
+        rate = 25;
+    else if(rate > 1000)
+        rate = 1000;
+    // CTC mode, prescale 64
+    TCCR3A = 0;
+    TCCR3B = _BV(WGM32) | _BV(CS31) | _BV(CS30);
+    OCR3A = F_CPU / 64 / rate - 1;
+    TIMSK3 |= _BV(OCIE3A);
+#endif
+}
+
+void capture_interrupt_init() {
+#if defined(__AVR_ATmega2560__)
+    TCCR4A = 0;
+    TCCR4B = _BV(CS42) | _BV(CS40); // normal mode, prescale 1024, capture on falling edge
+    TIFR4 = _BV(ICF4);              // discard any earlier edge
+    TIMSK4 |= _BV(ICIE4);
+#endif
+}
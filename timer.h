@@ -1,6 +1,24 @@
 #ifndef TIMER_H
 #define TIMER_H
+#include <stdint.h>
 
 void sample_timer_init(int samplerate);
 
+// system clock on timer0, counts milliseconds since system_timer_init()
+void system_timer_init();
+uint32_t millis();
+// microseconds since system_timer_init() (resolution 4us at 16MHz, wraps after ~71 minutes)
+uint32_t micros();
+
+// step timer for VolumeControl, TIMER2_COMPA_vect <rate> times per second (62-2000)
+void step_timer_init(uint16_t rate);
+
+// render timer for the frame interpolation (render.h), TIMER3_COMPA_vect <rate> times
+// per second (25-1000), 0 stops it
+void render_timer_init(uint16_t rate);
+
+// falling-edge interrupt (TIMER4_CAPT_vect) on ICP4 / PL0 using the input capture unit
+// of timer4, for pins that have no external or pin change interrupt
+void capture_interrupt_init();
+
 #endif
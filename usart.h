@@ -9,6 +9,8 @@
 #define USART_H
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdarg.h>
 #include "circular_buffer.h"
 
 typedef volatile uint8_t& reg_t;
@@ -33,80 +35,276 @@ USART_t get_USART() {
     }
 }
 
-// pointers to any USART objects
-void* USART_PTRS[4] = {
-    0,
-    0,
-    0,
-    0
+// interface used by the USART interrupts
+// (independent of buffer sizes, so any USART<N, ...> can be reached from its ISR)
+class USART_base {
+    public:
+        virtual void rx_interrupt() = 0;
+        virtual void udre_interrupt() = 0;
+};
+
+// pointer to the USART object attached to USART<N> (null if there is none)
+template <int N>
+struct USART_instance {
+    static USART_base* ptr;
 };
+template <int N> USART_base* USART_instance<N>::ptr = 0;
 
 // USART class
-// usage: USART<N, BUFSIZE> my_usart(baudrate);
+// usage: USART<N, RX_BUFSIZE, TX_BUFSIZE> my_usart(baudrate);
 //  N is the USART number (e.g. USART<0> = USART0)
-//  BUFSIZE is the size of RX buffer to use
+//  RX_BUFSIZE is the size of RX buffer to use
+//  TX_BUFSIZE is the size of TX buffer to use
 //
 //  the rx buffer is populated by the USART receive interrupt and cleared by the read() method
-template <int N, int BUFSIZE=128>
-class USART {
+//  the tx buffer is filled by write()/print()/printf() and drained by the data register empty interrupt
+//
+//  write(), print() and printf() never block: anything that does not fit in the tx buffer
+//  is dropped (and counted, see dropped()). send() blocks until there is room for its byte.
+template <int N, int RX_BUFSIZE=128, int TX_BUFSIZE=128>
+class USART : public USART_base {
     private:
         USART_t usart; // references to config/data registers
-        //CircularBuffer<uint8_t, BUFSIZE> tx_buffer;
-        CircularBuffer<uint8_t, BUFSIZE> rx_buffer;
+        CircularBuffer<uint8_t, TX_BUFSIZE> tx_buffer;
+        CircularBuffer<uint8_t, RX_BUFSIZE> rx_buffer;
+        uint16_t tx_dropped; // bytes dropped because the tx buffer was full
+
+        // queue one byte without checking for space
+        // UDRIE is cleared while the buffer is modified so the interrupt can't interleave
+        void queue(uint8_t value) {
+            usart.UCSRB &= ~_BV(UDRIE0);
+            tx_buffer.push(value);
+            usart.UCSRB |= _BV(UDRIE0);
+        }
+
+        // write a number in the given base, padded to <width> with <pad>
+        int print_number(unsigned long value, bool negative, uint8_t base, 
+                int width = 0, char pad = ' ', bool upper = false) {
+            char output[12]; // enough for 32-bit octal/decimal and a sign
+            int size = 0;
+            do {
+                uint8_t digit = value % base;
+                output[size++] = digit < 10 ? digit + '0' : digit - 10 + (upper ? 'A' : 'a');
+                value /= base;
+            } while(value);
+
+            int written = 0;
+            if(negative && pad == '0')
+                written += write('-');
+            for(int i = size + negative; i < width; i++)
+                written += write(pad);
+            if(negative && pad != '0')
+                written += write('-');
+            while(size)
+                written += write(output[--size]);
+            return written;
+        }
+
+        // printf-style formatter
+        // supports %c %s %S (PROGMEM string) %d %i %u %x %X %%, 'l' for long arguments,
+        // '0' padding and a field width. <progmem> selects where <fmt> is stored.
+        int vformat(const char* fmt, va_list args, bool progmem) {
+            int written = 0;
+            for(;;) {
+                char c = progmem ? pgm_read_byte(fmt++) : *fmt++;
+                if(!c)
+                    break;
+                if(c != '%') {
+                    written += write(c);
+                    continue;
+                }
+
+                char pad = ' ';
+                int width = 0;
+                bool is_long = false;
+                c = progmem ? pgm_read_byte(fmt++) : *fmt++;
+                if(c == '0') {
+                    pad = '0';
+                    c = progmem ? pgm_read_byte(fmt++) : *fmt++;
+                }
+                while(c >= '0' && c <= '9') {
+                    width = width * 10 + c - '0';
+                    c = progmem ? pgm_read_byte(fmt++) : *fmt++;
+                }
+                if(c == 'l') {
+                    is_long = true;
+                    c = progmem ? pgm_read_byte(fmt++) : *fmt++;
+                }
+
+                switch(c) {
+                    case 'c': 
+                        written += write((char)va_arg(args, int)); 
+                        break;
+                    case 's': 
+                        written += print(va_arg(args, const char*)); 
+                        break;
+                    case 'S': 
+                        written += print_P(va_arg(args, const char*)); 
+                        break;
+                    case 'd':
+                    case 'i': {
+                        long value = is_long ? va_arg(args, long) : va_arg(args, int);
+                        written += print_number(value < 0 ? -(unsigned long)value : value, 
+                                value < 0, 10, width, pad);
+                        break;
+                    }
+                    case 'u':
+                    case 'x':
+                    case 'X': {
+                        unsigned long value = is_long ? 
+                            va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                        written += print_number(value, false, c == 'u' ? 10 : 16, 
+                                width, pad, c == 'X');
+                        break;
+                    }
+                    case '%':
+                        written += write('%');
+                        break;
+                    case 0:
+                        return written; // format string ended in the middle of a conversion
+                    default:
+                        break;
+                }
+            }
+            return written;
+        }
 
     public:
         USART(long baud = 9600, int stopbits = 1):
-            usart(get_USART<N>())
+            usart(get_USART<N>()), tx_dropped(0)
         {
             select_baudrate(baud);
             usart.UCSRB = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
             usart.UCSRC = _BV(UCSZ00) | _BV(UCSZ01);
             if(stopbits == 2)
                 usart.UCSRC |= _BV(USBS0);
-            USART_PTRS[N] = this;
+            USART_instance<N>::ptr = this;
         }
 
         void rx_interrupt() {
             while( !(usart.UCSRA & _BV(RXC0)));
             rx_buffer.push(usart.UDR);
         }
+
+        // move the next queued byte into UDR, disable the interrupt once the buffer is empty
+        void udre_interrupt() {
+            if(tx_buffer.empty())
+                usart.UCSRB &= ~_BV(UDRIE0);
+            else
+                usart.UDR = tx_buffer.pop();
+        }
+
+        // calculate baud
+        // uses double speed mode (U2X) when it gets closer to <baud>. at 16MHz only
+        // 2M baud needs it, 500k and 1M are exact in normal mode
         void select_baudrate(long baud) {
-            // calculate baud
-            usart.UBRR = F_CPU / 16 / baud - 1;
+            long ubrr1x = (F_CPU / 16 + baud / 2) / baud - 1;
+            long ubrr2x = (F_CPU / 8 + baud / 2) / baud - 1;
+            if(ubrr1x < 0) ubrr1x = 0;
+            if(ubrr2x < 0) ubrr2x = 0;
+            long error1x = F_CPU / 16 / (ubrr1x + 1) - baud;
+            long error2x = F_CPU / 8 / (ubrr2x + 1) - baud;
+            if((error2x < 0 ? -error2x : error2x) < (error1x < 0 ? -error1x : error1x)) {
+                usart.UCSRA |= _BV(U2X0);
+                usart.UBRR = ubrr2x;
+            } else {
+                usart.UCSRA &= ~_BV(U2X0);
+                usart.UBRR = ubrr1x;
+            }
         }
 
+        // queue a byte for transmission, blocking while the tx buffer is full
         void send(uint8_t value) {
-            while(!(usart.UCSRA & _BV(UDRE0)));
-            usart.UDR = value;
+            while(tx_buffer.volatile_length() == TX_BUFSIZE) { // udre_interrupt() drains it
+                // with interrupts disabled nothing drains the buffer, so do it here
+                if(!(SREG & _BV(SREG_I)) && (usart.UCSRA & _BV(UDRE0)))
+                    udre_interrupt();
+            }
+            queue(value);
         }
 
-        void print(const char* value) {
+        // queue a byte for transmission without blocking
+        // returns false (and drops the byte) if the tx buffer is full
+        bool write(uint8_t value) {
+            if(tx_buffer.full()) {
+                tx_dropped++;
+                return false;
+            }
+            queue(value);
+            return true;
+        }
+
+        // queue up to <length> bytes without blocking
+        // returns the number of bytes accepted (nothing is dropped if it returns less than <length>)
+        int write(const uint8_t* data, int length) {
+            int count = length < tx_free() ? length : tx_free();
+            for(int i=0; i<count; i++)
+                queue(data[i]);
+            return count;
+        }
+
+        int print(const char* value) {
+            int written = 0;
             for(int i=0; value[i]; i++)
-                send(value[i]);
+                written += write(value[i]);
+            return written;
         }
 
-        // TODO: fix bug when printing the number 0
-        void print(int number) {
-            int size = number ? 0 : 1;
-            int ncopy = number;
-            char output[10];
-            for(;ncopy;) {
-                ncopy /= 10;
-                size++;
-            }
-            ncopy = number;
-            for(int i=0;ncopy;i++) {
-                output[size - 1 - i] = ncopy % 10 + '0';
-                ncopy /= 10;
-            }
-            for(int i=0; i<size; i++)
-                send(output[i]);
+        // print a string stored in program memory
+        int print_P(const char* value) {
+            int written = 0;
+            for(char c; (c = pgm_read_byte(value)); value++)
+                written += write(c);
+            return written;
+        }
+
+        int print(int number) {
+            return print_number(number < 0 ? -(unsigned long)number : number, number < 0, 10);
+        }
+
+        int printf(const char* fmt, ...) {
+            va_list args;
+            va_start(args, fmt);
+            int written = vformat(fmt, args, false);
+            va_end(args);
+            return written;
+        }
+
+        // printf with the format string in program memory, e.g. usart.printf_P(PSTR("%d\n"), x);
+        int printf_P(const char* fmt, ...) {
+            va_list args;
+            va_start(args, fmt);
+            int written = vformat(fmt, args, true);
+            va_end(args);
+            return written;
+        }
+
+        // free space in the tx buffer
+        int tx_free() const {
+            return TX_BUFSIZE - tx_buffer.length();
+        }
+
+        // number of bytes dropped because the tx buffer was full
+        uint16_t dropped() const {
+            return tx_dropped;
+        }
+
+        // block until every queued byte has been handed to the hardware
+        void flush() {
+            while(tx_buffer.volatile_length())
+                if(!(SREG & _BV(SREG_I)) && (usart.UCSRA & _BV(UDRE0)))
+                    udre_interrupt();
         }
+
         bool available() {
-            return rx_buffer.length() > 0;
+            return rx_buffer.volatile_length() > 0;
         }
         uint8_t read() {
-            return rx_buffer.pop();
+            // keep the receive interrupt from modifying the buffer during pop
+            usart.UCSRB &= ~_BV(RXCIE0);
+            uint8_t value = rx_buffer.pop();
+            usart.UCSRB |= _BV(RXCIE0);
+            return value;
         }
         uint8_t peek() {
             return rx_buffer.peek();
@@ -116,8 +314,14 @@ class USART {
 
 template<int N>
 void usart_rx_interrupt() {
-    if(USART_PTRS[N])
-        (reinterpret_cast<USART<N>*>(USART_PTRS[N])) -> rx_interrupt();
+    if(USART_instance<N>::ptr)
+        USART_instance<N>::ptr->rx_interrupt();
+}
+
+template<int N>
+void usart_udre_interrupt() {
+    if(USART_instance<N>::ptr)
+        USART_instance<N>::ptr->udre_interrupt();
 }
 
 // USART interrupts push UDR onto rx_buffer
@@ -137,4 +341,21 @@ ISR(USART3_RX_vect) {
     usart_rx_interrupt<3>();
 }
 
+// data register empty interrupts send the next byte from tx_buffer
+ISR(USART0_UDRE_vect) {
+    usart_udre_interrupt<0>();
+}
+
+ISR(USART1_UDRE_vect) {
+    usart_udre_interrupt<1>();
+}
+
+ISR(USART2_UDRE_vect) {
+    usart_udre_interrupt<2>();
+}
+
+ISR(USART3_UDRE_vect) {
+    usart_udre_interrupt<3>();
+}
+
 #endif
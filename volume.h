@@ -9,58 +9,151 @@
 // this design only works for encoders that use pull-up resistors on the encoder pins
 // and takes advantage of the wired-NAND properties of this circuit
 //
+// steps are queued and the Gray code sequence is emitted by tick(), which must be
+// called from a timer interrupt (one phase per tick, see set_rate()). nothing here
+// waits, steps queued while a sequence is running are merged into it.
+//
 // Copyright Aaron Schraner, 2018
 // 
 //
 #ifndef VOLUME_H
 #define VOLUME_H
+#include <avr/interrupt.h>
+#include "timer.h"
 
 class VolumeControl {
     private:
         const Pin e1, e2, gnd; //encoder pins 1 and 2, ground pin for easy connection
-        int state;
+        volatile uint8_t state;
+        volatile int16_t steps;  // net steps emitted since construction
+        volatile int16_t queued; // steps not emitted yet (negative: down)
+        volatile uint8_t probe;  // ticks until the movable() probe is sampled (0: none)
+        volatile bool probe_requested, can_move;
+        uint8_t settle;          // ticks in about 5ms at the current rate
+
+        // most steps that can be queued in either direction
+        static const int16_t max_queued = 1024;
+
         void output() const {
             // call this after incrementing or decrementing the state
             // pins assert low when bits 1 (e1) or 0 (e2) are set high
             const static uint8_t states[4] = {0, 2, 3, 1};
             e1.mode(states[state] & 2 ? OUTPUT : INPUT);
             e2.mode(states[state] & 1 ? OUTPUT : INPUT);
-            _delay_ms(2);
+        }
+
+        // read a 16-bit variable that tick() changes
+        static int16_t atomic_read(const volatile int16_t& value) {
+            const uint8_t sreg = SREG;
+            cli();
+            const int16_t result = value;
+            SREG = sreg;
+            return result;
         }
 
     public:
         // set up pins, start with both open (encoder unaffected)
         VolumeControl(const Pin& e1, const Pin& e2, const Pin& gnd): 
-            e1(e1), e2(e2), gnd(gnd), state(0) {
+            e1(e1), e2(e2), gnd(gnd), state(0), steps(0), queued(0), probe(0), 
+            probe_requested(false), can_move(false), settle(3) {
             gnd.set(0);
             e1.set(0);
             e2.set(0);
             gnd.mode(OUTPUT);
             output();
         }
-        
+
+        // emit <rate> phases per second (timer2, 62-2000)
+        void set_rate(uint16_t rate) {
+            step_timer_init(rate);
+            settle = rate / 200 + 1;
+        }
+
+        // queue <count> steps (positive: up), on top of those not emitted yet
+        void move(int16_t count) {
+            const uint8_t sreg = SREG;
+            cli();
+            int16_t total = queued + count;
+            if(total > max_queued)
+                total = max_queued;
+            else if(total < -max_queued)
+                total = -max_queued;
+            queued = total;
+            SREG = sreg;
+        }
+
         // volume up
         inline void up() {
-            state = (state + 1) % 4;
-            output();
+            move(1);
         }
 
         // volume down
         inline void down() {
-            state = (state + 3) % 4;
-            output();
+            move(-1);
         }
 
-        // returns true if physical rotary encoder is at a position
-        // that allows proper functioning of the code
-        // also, resets state to 0 (both pins unconnected)
-        bool movable() {
-            state = 0;
-            output();
-            _delay_ms(5);
-            bool result = e1 && e2;
+        // net number of steps (up minus down) emitted so far
+        int16_t position() const {
+            return atomic_read(steps);
+        }
+
+        // position once the queued steps are emitted
+        int16_t target() const {
+            const uint8_t sreg = SREG;
+            cli();
+            const int16_t result = steps + queued;
+            SREG = sreg;
             return result;
         }
+
+        // steps still queued or a probe running
+        bool busy() const {
+            return atomic_read(queued) || probe_requested || probe;
+        }
+
+        // check if the physical rotary encoder is at a position that allows proper
+        // functioning of the code: once the queued steps are done, resets state to 0
+        // (both pins unconnected) and samples the pins about 5ms later.
+        // the result is available from movable() when checking() returns false
+        void check() {
+            probe_requested = true;
+        }
+
+        bool checking() const {
+            return probe_requested || probe;
+        }
+
+        // result of the last check()
+        bool movable() const {
+            return can_move;
+        }
+
+        // emit the next phase of the queued steps or advance the probe
+        // (call from the step timer interrupt)
+        void tick() {
+            if(queued > 0) {
+                state = (state + 1) % 4;
+                steps++;
+                queued--;
+                output();
+            }
+            else if(queued < 0) {
+                state = (state + 3) % 4;
+                steps--;
+                queued++;
+                output();
+            }
+            else if(probe) {
+                if(--probe == 0)
+                    can_move = e1 && e2;
+            }
+            else if(probe_requested) {
+                probe_requested = false;
+                state = 0;
+                output();
+                probe = settle;
+            }
+        }
 };
 
 